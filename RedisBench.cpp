@@ -0,0 +1,296 @@
+#include <cmath>
+
+#include "RedisShard.h"
+
+// 客户端基准测试(make bench),结果可以与redis --bench的单连接结果对照:
+//   bench dist [--keys 键数] [--shards 分片数] [--vnodes 每个分片的虚拟节点数]
+//       键在一致性哈希环上的分布与增加一个分片时迁移的键比例,只计算哈希环,不需要redis-server
+//   bench fanout --shards host:port,host:port[,...] [--threads 线程数] [--batch 每批键数]
+//                [--requests 每个线程的批数] [--keyspace 键数] [--size 值字节数] [--conns 每个分片的连接数]
+//       多个线程并行执行跨分片的MSET与MGET,输出每秒的键数与每批(一次MSet/MGet调用)的延迟分布.
+//       用同样的参数只指定一个分片运行一次,可以得到并行扇出相对单实例的提升
+//   bench queue [--host host:port] [--messages 消息数] [--batch 每批消息数] [--size 消息字节数]
+//       在一条连接上比较三种队列的生产与消费吞吐量:列表(consume的BLPOP+LPOP COUNT)、
+//       带备份列表的可靠队列(BLMOVE/LMOVE+LREM)与消息流(XADD,consumeStream的XREADGROUP+XACK)
+// 密码通过环境变量REDIS_PASSWORD指定
+
+static int64 GetMicrosecond() {
+    return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 解析host:port,host:port形式的分片列表
+static bool ParseShards(const string& str, vector<pair<string, int>>& shards) {
+    stringstream ss(str);
+    string item;
+    while(getline(ss, item, ',')){
+        size_t pos = item.rfind(':');
+        if(pos == string::npos || pos == 0 || atoi(item.c_str() + pos + 1) <= 0){
+            return false;
+        }
+        shards.push_back(make_pair(item.substr(0, pos), atoi(item.c_str() + pos + 1)));
+    }
+    return shards.size() > 0;
+}
+
+// 输出耗时(微秒)的分布,vec会被排序
+static void PrintLatency(const char* name, vector<int64>& vec, int64 keys, int64 cost) {
+    if(vec.empty()){
+        return;
+    }
+    sort(vec.begin(), vec.end());
+    auto percentile = [&](double p){
+        return vec[std::min((size_t)(p * vec.size()), vec.size() - 1)];
+    };
+    printf("%-6s %lld keys in %.3f s, %.0f keys/s, batch latency(us) p50 %lld p99 %lld p99.9 %lld max %lld\n",
+           name, (long long)keys, cost / 1000000.0, cost > 0 ? keys * 1000000.0 / cost : 0.0,
+           (long long)percentile(0.5), (long long)percentile(0.99), (long long)percentile(0.999), (long long)vec.back());
+}
+
+static int RunDist(int keys, int shards, int vnodes) {
+    RedisShardPool pool;
+    vector<pair<string, int>> nodes;
+    vector<int> owner(keys);
+    vector<int64> counts(shards, 0);
+
+    for(int i = 0; i < shards; ++i){
+        nodes.push_back(make_pair("127.0.0.1", 6379 + i));
+    }
+    // 连接数为0时只建立哈希环,不连接redis
+    pool.Init(nodes, "", 0, 3000, 2 * 1024 * 1024, vnodes);
+
+    for(int i = 0; i < keys; ++i){
+        owner[i] = pool.GetShardIndex("key:" + to_string(i));
+        ++counts[owner[i]];
+    }
+
+    double mean = (double)keys / shards;
+    double var = 0;
+    for(int i = 0; i < shards; ++i){
+        var += (counts[i] - mean) * (counts[i] - mean);
+        printf("shard %d: %lld keys (%.1f%%)\n", i, (long long)counts[i], counts[i] * 100.0 / keys);
+    }
+    int64 maxCount = *max_element(counts.begin(), counts.end());
+    int64 minCount = *min_element(counts.begin(), counts.end());
+    printf("%d keys, %d shards, %d vnodes: max/mean %.3f, min/mean %.3f, stddev/mean %.3f\n",
+           keys, shards, vnodes, maxCount / mean, minCount / mean, sqrt(var / shards) / mean);
+
+    pool.AddShard("127.0.0.1", 6379 + shards);
+
+    int moved = 0;
+    int wrong = 0;
+    for(int i = 0; i < keys; ++i){
+        int idx = pool.GetShardIndex("key:" + to_string(i));
+        if(idx != owner[i]){
+            ++moved;
+            // 增加分片时键只应该迁移到新分片
+            if(idx != shards){
+                ++wrong;
+            }
+        }
+    }
+    printf("add shard %d: %.2f%% keys moved (ideal %.2f%%), %d moved between old shards\n",
+           shards, moved * 100.0 / keys, 100.0 / (shards + 1), wrong);
+    return 0;
+}
+
+struct FanOutOption {
+    int threads;
+    int batch;
+    int requests;
+    int keyspace;
+    int size;
+    int conns;
+};
+
+static int RunFanOut(const vector<pair<string, int>>& shards, const string& passwd, const FanOutOption& opt) {
+    RedisShardPool pool;
+    atomic<int64> errors(0);
+    string val(opt.size, 'x');
+
+    pool.Init(shards, passwd, opt.conns);
+
+    // 依次测试MSET与MGET,每个阶段所有线程同时开始
+    for(int phase = 0; phase < 2; ++phase){
+        vector<vector<int64>> costs(opt.threads);
+        vector<std::thread> threads;
+        int64 stime = GetMicrosecond();
+
+        for(int t = 0; t < opt.threads; ++t){
+            threads.push_back(std::thread([&, t](){
+                vector<string> keys(opt.batch);
+                vector<string> vals;
+                vector<pair<string, string>> kvs(opt.batch);
+
+                costs[t].reserve(opt.requests);
+                for(int r = 0; r < opt.requests; ++r){
+                    for(int i = 0; i < opt.batch; ++i){
+                        int64 idx = ((int64)(t) * opt.requests + r) * opt.batch + i;
+                        keys[i] = "bench:" + to_string(idx % opt.keyspace);
+                        kvs[i].first = keys[i];
+                        kvs[i].second = val;
+                    }
+                    int64 now = GetMicrosecond();
+                    int res = phase == 0 ? pool.MSet(kvs) : pool.MGet(keys, vals);
+                    costs[t].push_back(GetMicrosecond() - now);
+                    if(res < 0){
+                        ++errors;
+                    }
+                }
+            }));
+        }
+        for(auto& item : threads){
+            item.join();
+        }
+
+        int64 cost = GetMicrosecond() - stime;
+        vector<int64> all;
+        for(const auto& item : costs){
+            all.insert(all.end(), item.begin(), item.end());
+        }
+        PrintLatency(phase == 0 ? "MSET" : "MGET", all, (int64)(opt.threads) * opt.requests * opt.batch, cost);
+    }
+
+    printf("%d shards, %d threads, %d keys per batch, %lld failed batches\n",
+           (int)shards.size(), opt.threads, opt.batch, (long long)errors.load());
+    return errors > 0 ? -1 : 0;
+}
+
+struct QueueOption {
+    int messages;
+    int batch;
+    int size;
+};
+
+static void PrintQueue(const char* name, int count, int64 produce, int64 consume) {
+    printf("%-16s %d messages, produce %.0f msg/s, consume %.0f msg/s\n", name, count,
+           produce > 0 ? count * 1000000.0 / produce : 0.0, consume > 0 ? count * 1000000.0 / consume : 0.0);
+}
+
+static int RunQueue(const string& host, int port, const string& passwd, const QueueOption& opt) {
+    RedisConnect redis;
+    const string key = "bench:queue";
+    const string backup = "bench:queue:backup";
+    const string stream = "bench:stream";
+    const string val(opt.size, 'x');
+
+    if(!redis.connectRedis(host, port) || redis.auth(passwd) < 0){
+        printf("REDIS[%s][%d]连接失败\n", host.c_str(), port);
+        return -1;
+    }
+    redis.del(key);
+    redis.del(backup);
+    redis.del(stream);
+
+    // 列表:每批用一次RPUSH写入,消费时backup为空使用BLPOP+LPOP COUNT,否则使用BLMOVE/LMOVE+LREM
+    for(int mode = 0; mode < 2; ++mode){
+        int count = 0;
+        int64 stime = GetMicrosecond();
+
+        for(int i = 0; i < opt.messages; i += opt.batch){
+            if(redis.rpush(key, vector<string>(min(opt.batch, opt.messages - i), val)) < 0){
+                printf("rpush failed[%s]\n", redis.getErrorString().c_str());
+                return -1;
+            }
+        }
+        int64 produce = GetMicrosecond() - stime;
+
+        stime = GetMicrosecond();
+        redis.consume(key, opt.batch, [&](vector<string>& vec){
+            count += vec.size();
+            // 等待超时(空数组)说明消息已经取完或出错
+            return count < opt.messages && vec.size() > 0;
+        }, 1, mode == 0 ? "" : backup);
+        int64 consume = GetMicrosecond() - stime;
+
+        PrintQueue(mode == 0 ? "lpop" : "lmove+lrem", count, produce, consume);
+        redis.del(key);
+        redis.del(backup);
+    }
+
+    // 消息流:每批用一次pipeline写入XADD,消费组从头读取
+    int count = 0;
+    vector<vector<pair<string, string>>> entries;
+
+    redis.xgroupCreate(stream, "bench", "0");
+    int64 stime = GetMicrosecond();
+    for(int i = 0; i < opt.messages; i += opt.batch){
+        entries.assign(min(opt.batch, opt.messages - i), vector<pair<string, string>>(1, make_pair("data", val)));
+        if(redis.xadd(stream, entries) < 0){
+            printf("xadd failed[%s]\n", redis.getErrorString().c_str());
+            return -1;
+        }
+    }
+    int64 produce = GetMicrosecond() - stime;
+
+    stime = GetMicrosecond();
+    redis.consumeStream(stream, "bench", "bench-1", opt.batch, 1000, [&](vector<RedisConnect::StreamEntry>& vec){
+        count += vec.size();
+        return count < opt.messages && vec.size() > 0;
+    });
+    int64 consume = GetMicrosecond() - stime;
+
+    PrintQueue("xreadgroup+xack", count, produce, consume);
+    redis.del(stream);
+
+    return count < opt.messages ? -1 : 0;
+}
+
+int main(int argc, char** argv) {
+    // 获取"--name value"形式的选项,不存在时返回def
+    auto GetCmdOption = [&](const char* name, const char* def){
+        for(int i = 2; i + 1 < argc; i++){
+            if(strcmp(argv[i], name) == 0) return (const char*)(argv[i + 1]);
+        }
+        return def;
+    };
+
+    const char* cmd = argc > 1 ? argv[1] : "";
+    const char* passwd = getenv("REDIS_PASSWORD");
+
+    if(strcmp(cmd, "dist") == 0){
+        int keys = max(atoi(GetCmdOption("--keys", "1000000")), 1);
+        int shards = max(atoi(GetCmdOption("--shards", "4")), 1);
+        int vnodes = max(atoi(GetCmdOption("--vnodes", "160")), 1);
+
+        return RunDist(keys, shards, vnodes);
+    }
+
+    if(strcmp(cmd, "fanout") == 0){
+        FanOutOption opt;
+        vector<pair<string, int>> shards;
+
+        if(!ParseShards(GetCmdOption("--shards", ""), shards)){
+            printf("请使用--shards参数指定分片(host:port,host:port)\n");
+            return -1;
+        }
+        opt.threads = max(atoi(GetCmdOption("--threads", "4")), 1);
+        opt.batch = max(atoi(GetCmdOption("--batch", "100")), 1);
+        opt.requests = max(atoi(GetCmdOption("--requests", "1000")), 1);
+        opt.keyspace = max(atoi(GetCmdOption("--keyspace", "100000")), 1);
+        opt.size = max(atoi(GetCmdOption("--size", "16")), 0);
+        opt.conns = max(atoi(GetCmdOption("--conns", "4")), 1);
+
+        return RunFanOut(shards, passwd ? passwd : "", opt);
+    }
+
+    if(strcmp(cmd, "queue") == 0){
+        QueueOption opt;
+        vector<pair<string, int>> hosts;
+
+        if(!ParseShards(GetCmdOption("--host", "127.0.0.1:6379"), hosts)){
+            printf("--host参数格式错误(host:port)\n");
+            return -1;
+        }
+        opt.messages = max(atoi(GetCmdOption("--messages", "100000")), 1);
+        opt.batch = max(atoi(GetCmdOption("--batch", "100")), 1);
+        opt.size = max(atoi(GetCmdOption("--size", "64")), 0);
+
+        return RunQueue(hosts[0].first, hosts[0].second, passwd ? passwd : "", opt);
+    }
+
+    printf("usage: bench dist [--keys 1000000] [--shards 4] [--vnodes 160]\n");
+    printf("       bench fanout --shards host:port,host:port [--threads 4] [--batch 100] [--requests 1000]\n");
+    printf("                    [--keyspace 100000] [--size 16] [--conns 4]\n");
+    printf("       bench queue [--host 127.0.0.1:6379] [--messages 100000] [--batch 100] [--size 64]\n");
+    return -1;
+}
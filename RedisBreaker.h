@@ -0,0 +1,277 @@
+#ifndef REDIS_BREAKER
+#define REDIS_BREAKER
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <stdint.h>
+#include "typedef.h"
+
+using namespace std;
+
+// 熔断器:统计一个节点最近window毫秒内的请求数与失败数(网络错误、超时),请求数达到minRequests且
+// 失败比例达到errorRate时打开.打开期间allow直接返回false,请求在微秒内失败,不再等待连接或读取超时;
+// 退避时间过后进入半开状态,最多同时放行probes个探测请求,连续probes个成功后关闭,任何一个失败则重新打开,
+// 退避时间加倍(不超过maxDelay)并加入±20%的随机抖动,避免多个客户端同时探测.
+// 关闭状态下allow只读取一个原子变量,record记录成功时只更新原子计数,失败或状态变化时才加锁;
+// 半开状态只由探测请求(allow返回的令牌大于0)的结果决定,之前放行的普通请求的结果不再计入
+class RedisBreaker{
+public:
+    enum State{
+        CLOSED = 0,     // 正常
+        OPEN = 1,       // 打开,请求直接失败
+        HALF_OPEN = 2   // 半开,放行少量探测请求
+    };
+
+    struct Option{
+        int window;        // 统计失败率的时间窗口(毫秒)
+        int minRequests;   // 窗口内的请求数达到minRequests才判断失败率
+        double errorRate;  // 打开熔断的失败比例
+        int baseDelay;     // 第一次打开的退避时间(毫秒)
+        int maxDelay;      // 退避时间上限(毫秒)
+        int probes;        // 半开状态下同时放行的探测请求数,也是关闭需要的连续成功数
+
+        Option(): window(10000), minRequests(20), errorRate(0.5), baseDelay(500), maxDelay(30000), probes(3){}
+    };
+
+    struct Stat{
+        atomic<int64> requests;  // 记录结果的请求数
+        atomic<int64> failures;  // 失败的请求数
+        atomic<int64> rejects;   // 因熔断直接失败的请求数
+        atomic<int64> opens;     // 打开的次数
+        atomic<int64> probes;    // 放行的探测请求数
+
+        Stat(): requests(0), failures(0), rejects(0), opens(0), probes(0){}
+    };
+
+protected:
+    static const int BUCKETS = 10;  // 时间窗口分成的桶数
+
+    struct Bucket{
+        atomic<int64> epoch;  // 桶对应的时间段序号,只在持有mtx时修改
+        atomic<int> total;
+        atomic<int> failures;
+    };
+
+public:
+    static const int64 REJECTED = -1;  // allow的返回值:请求应当直接失败
+    static const int64 NORMAL = 0;     // allow的返回值:关闭状态下的普通请求
+
+    RedisBreaker(const Option& option = Option()): option(option), state(CLOSED), openUntil(0){
+        this->option.window = max(option.window, (int)(BUCKETS));
+        this->option.probes = max(option.probes, 1);
+        for (auto& item : buckets){
+            item.epoch = -1;
+            item.total = 0;
+            item.failures = 0;
+        }
+    }
+
+    // 请求之前调用,返回REJECTED时请求应当直接失败;否则请求完成后把返回的令牌传给record.
+    // 令牌大于0表示半开状态下的探测请求(值为本轮半开的序号)
+    int64 allow(){
+        int cur = state.load(memory_order_acquire);
+
+        if (cur == CLOSED){
+            return NORMAL;
+        }
+
+        int64 now = GetMillisecond();
+
+        if (cur == OPEN && now < openUntil.load(memory_order_relaxed)){
+            ++stat.rejects;
+            return REJECTED;
+        }
+
+        lock_guard<mutex> lk(mtx);
+
+        if (state == CLOSED){
+            return NORMAL;
+        }
+
+        if (state == OPEN){
+            if (now < openUntil){
+                ++stat.rejects;
+                return REJECTED;
+            }
+            state = HALF_OPEN;
+            inflight = 0;
+            successes = 0;
+            ++round;
+        }
+
+        // 探测请求没有记录结果(如调用者异常退出)时,一个窗口后开始新的一轮探测,之前的令牌作废
+        if (inflight >= option.probes && now - lastProbe < option.window){
+            ++stat.rejects;
+            return REJECTED;
+        }
+        if (inflight >= option.probes){
+            inflight = 0;
+            successes = 0;
+            ++round;
+        }
+        ++inflight;
+        ++stat.probes;
+        lastProbe = now;
+
+        return round;
+    }
+
+    // 记录请求的结果,token为allow的返回值,success为false表示网络错误或超时(redis返回的错误回复属于成功)
+    void record(int64 token, bool success){
+        int64 now = GetMillisecond();
+
+        ++stat.requests;
+
+        if (!success){
+            ++stat.failures;
+        }
+
+        if (token > 0){
+            recordProbe(token, success, now);
+            return;
+        }
+
+        // 打开之前或半开期间完成的普通请求不再计入
+        if (state.load(memory_order_acquire) != CLOSED){
+            return;
+        }
+
+        int64 span = option.window / BUCKETS;
+        int64 epoch = now / span;
+        Bucket& bucket = buckets[epoch % BUCKETS];
+
+        // 成功且不需要切换到新的时间段时不加锁
+        if (success && bucket.epoch.load(memory_order_acquire) == epoch){
+            bucket.total.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+
+        lock_guard<mutex> lk(mtx);
+
+        if (state != CLOSED){
+            return;
+        }
+
+        int64 cur = bucket.epoch.load(memory_order_relaxed);
+
+        // 调用者在两次取时间之间停顿过久,桶已经属于更新的时间段
+        if (cur > epoch){
+            return;
+        }
+
+        if (cur != epoch){
+            bucket.total.store(0, memory_order_relaxed);
+            bucket.failures.store(0, memory_order_relaxed);
+            bucket.epoch.store(epoch, memory_order_release);
+        }
+
+        bucket.total.fetch_add(1, memory_order_relaxed);
+
+        if (success){
+            return;
+        }
+
+        bucket.failures.fetch_add(1, memory_order_relaxed);
+
+        int total = 0;
+        int failures = 0;
+
+        for (const auto& item : buckets){
+            if (item.epoch.load(memory_order_relaxed) > epoch - BUCKETS){
+                total += item.total.load(memory_order_relaxed);
+                failures += item.failures.load(memory_order_relaxed);
+            }
+        }
+
+        if (total >= option.minRequests && failures >= option.errorRate * total){
+            trip(now);
+        }
+    }
+
+    // 是否处于打开状态且还在退避时间内(不会改变状态,用于选择节点)
+    bool isOpen() const{
+        return state.load(memory_order_acquire) == OPEN && GetMillisecond() < openUntil.load(memory_order_relaxed);
+    }
+
+    State getState() const{
+        return (State)(state.load());
+    }
+
+    // 当前的退避时间(毫秒),关闭状态下为0
+    int64 getDelay(){
+        lock_guard<mutex> lk(mtx);
+        return delay;
+    }
+
+    const Option& getOption() const{
+        return option;
+    }
+
+    const Stat& getStat() const{
+        return stat;
+    }
+
+protected:
+    static int64 GetMillisecond(){
+        return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // 记录探测请求的结果,上一轮的探测请求不影响状态
+    void recordProbe(int64 token, bool success, int64 now){
+        lock_guard<mutex> lk(mtx);
+
+        if (state != HALF_OPEN || token != round){
+            return;
+        }
+
+        if (inflight > 0){
+            inflight--;
+        }
+
+        if (!success){
+            trip(now);
+        } else if (++successes >= option.probes){
+            state = CLOSED;
+            delay = 0;
+            for (auto& item : buckets){
+                item.epoch.store(-1, memory_order_relaxed);
+            }
+        }
+    }
+
+    // 打开熔断,需要持有mtx
+    void trip(int64 now){
+        static thread_local u_int32 seed = 0;
+
+        if (seed == 0){
+            seed = (u_int32)((size_t)(&seed) ^ now) | 1;
+        }
+
+        // xorshift32
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+
+        delay = delay == 0 ? option.baseDelay : min(delay * 2, (int64)(option.maxDelay));
+        openUntil = now + delay * (80 + seed % 41) / 100;
+        state = OPEN;
+
+        ++stat.opens;
+    }
+
+protected:
+    Option option;
+    atomic<int> state;
+    atomic<int64> openUntil;  // 打开状态持续到的时间(毫秒)
+    mutex mtx;
+    int64 delay = 0;  // 当前的退避时间
+    int inflight = 0;  // 半开状态下未完成的探测请求数
+    int successes = 0;  // 半开状态下连续成功的探测请求数
+    int64 lastProbe = 0;
+    int64 round = 0;  // 半开的轮数,作为探测请求的令牌
+    Bucket buckets[BUCKETS];
+    Stat stat;
+};
+
+#endif
@@ -0,0 +1,317 @@
+#ifndef REDIS_CODEC
+#define REDIS_CODEC
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "typedef.h"
+
+using namespace std;
+
+// 值压缩编码:超过阈值的值使用LZ4块格式压缩,压缩后的值带有HEAD_SIZE字节的头部
+// (4字节标记 + 4字节原始长度),读取时根据标记自动识别,未压缩的值原样返回.
+// 哈希表与输出缓冲区是线程局部的,在同一线程的多次调用之间复用,因此一个RedisCodec可以被多个连接共享
+class RedisCodec{
+public:
+    static const int HEAD_SIZE = 8;  // 头部长度
+    static const int HASH_BITS = 12;  // 压缩哈希表大小为2^HASH_BITS
+    static const int MIN_MATCH = 4;  // 最短匹配长度
+    static const int MAX_OFFSET = 65535;  // 最远匹配距离
+    static const int MAX_SIZE = 512 * 1024 * 1024;  // 默认的解压长度上限(与redis字符串的长度上限相同)
+
+    // 压缩统计(所有连接共享)
+    struct Stat{
+        atomic<int64> compressCount;     // 压缩次数
+        atomic<int64> skipCount;         // 压缩后没有变小而放弃压缩的次数
+        atomic<int64> rawBytes;          // 压缩前的总字节数
+        atomic<int64> zipBytes;          // 压缩后的总字节数
+        atomic<int64> compressTime;      // 压缩耗时(微秒)
+        atomic<int64> decompressCount;   // 解压次数
+        atomic<int64> decompressTime;    // 解压耗时(微秒)
+
+        Stat(): compressCount(0), skipCount(0), rawBytes(0), zipBytes(0),
+                compressTime(0), decompressCount(0), decompressTime(0){}
+
+        // 压缩率(压缩后/压缩前)
+        double getRatio() const{
+            return rawBytes > 0 ? (double)(zipBytes) / rawBytes : 1.0;
+        }
+    };
+
+    static Stat& GetStat(){
+        static Stat stat;
+        return stat;
+    }
+
+    static bool IsCompressed(const char* data, int len){
+        return len >= HEAD_SIZE && memcmp(data, Magic(), 4) == 0;
+    }
+
+public:
+    RedisCodec(int threshold = 1024, int maxSize = MAX_SIZE): threshold(threshold), maxSize(maxSize){}
+
+    void setThreshold(int threshold){
+        this->threshold = threshold;
+    }
+
+    int getThreshold() const{
+        return threshold;
+    }
+
+    // 解压长度上限:头部记录的原始长度超过上限时不解压,避免损坏的数据导致分配过大的内存
+    void setMaxSize(int maxSize){
+        this->maxSize = maxSize;
+    }
+
+    int getMaxSize() const{
+        return maxSize;
+    }
+
+    // 编码:长度达到阈值且压缩后变小时返回线程局部缓冲区中的压缩结果(在当前线程下一次编码前有效),否则返回val本身
+    const string& encode(const string& val){
+        int limit = threshold;
+
+        if (limit <= 0 || (int)(val.size()) < limit){
+            return val;
+        }
+
+        string& buffer = Buffer();
+        Stat& stat = GetStat();
+        int64 stime = GetMicrosecond();
+        int len = val.size();
+
+        buffer.resize(HEAD_SIZE + len);
+        memcpy(&buffer[0], Magic(), 4);
+        for (int i = 0; i < 4; i++){
+            buffer[4 + i] = (char)((len >> (i * 8)) & 0xFF);
+        }
+
+        int sz = Compress(val.c_str(), len, &buffer[HEAD_SIZE], len - HEAD_SIZE);
+
+        stat.compressTime += GetMicrosecond() - stime;
+
+        if (sz <= 0){
+            ++stat.skipCount;
+            return val;
+        }
+
+        buffer.resize(HEAD_SIZE + sz);
+
+        ++stat.compressCount;
+        stat.rawBytes += len;
+        stat.zipBytes += buffer.size();
+
+        return buffer;
+    }
+
+    // 解码:val是压缩数据时原地替换为解压结果,数据损坏时返回false
+    bool decode(string& val){
+        if (!IsCompressed(val.c_str(), val.size())){
+            return true;
+        }
+
+        string& buffer = Buffer();
+        Stat& stat = GetStat();
+        int64 stime = GetMicrosecond();
+        int len = 0;
+
+        for (int i = 0; i < 4; i++){
+            len |= (int)((u_char)(val[4 + i])) << (i * 8);
+        }
+        // LZ4每个输入字节最多展开为255个字节,超过这个比例或上限的长度一定是损坏的数据
+        if (len < 0 || len > maxSize || (int64)(len) > (int64)(val.size() - HEAD_SIZE) * 255 + 16){
+            return false;
+        }
+
+        buffer.resize(len);
+
+        if (Decompress(val.c_str() + HEAD_SIZE, val.size() - HEAD_SIZE, len ? &buffer[0] : NULL, len) != len){
+            string().swap(buffer);
+            return false;
+        }
+
+        val.swap(buffer);
+
+        ++stat.decompressCount;
+        stat.decompressTime += GetMicrosecond() - stime;
+
+        return true;
+    }
+
+public:
+    // LZ4块格式压缩,输出超过cap时返回-1(数据不可压缩)
+    static int Compress(const char* src, int len, char* dst, int cap){
+        vector<int>& table = Table();
+        const u_char* in = (const u_char*)(src);
+        const int limit = len - 12;  // 最后一个匹配必须在距离结尾12字节之前开始
+        const int tail = len - 5;    // 最后5个字节必须是字面量
+        int anchor = 0;
+        int pos = 0;
+        int out = 0;
+
+        if (cap <= 0){
+            return -1;
+        }
+
+        fill(table.begin(), table.end(), 0);
+
+        while (pos < limit){
+            u_int32 seq = Read32(in + pos);
+            u_int32 hash = (seq * 2654435761U) >> (32 - HASH_BITS);
+            int ref = table[hash] - 1;
+
+            table[hash] = pos + 1;
+
+            if (ref < 0 || pos - ref > MAX_OFFSET || Read32(in + ref) != seq){
+                ++pos;
+                continue;
+            }
+
+            int match = MIN_MATCH;
+            while (pos + match < tail && in[ref + match] == in[pos + match]){
+                ++match;
+            }
+
+            if ((out = WriteSequence(dst, out, cap, in + anchor, pos - anchor, pos - ref, match)) < 0){
+                return -1;
+            }
+
+            pos += match;
+            anchor = pos;
+        }
+
+        return WriteSequence(dst, out, cap, in + anchor, len - anchor, 0, 0);
+    }
+
+    // LZ4块格式解压,返回解压后的长度,数据损坏返回-1
+    static int Decompress(const char* src, int len, char* dst, int cap){
+        const u_char* in = (const u_char*)(src);
+        const u_char* end = in + len;
+        int out = 0;
+
+        while (in < end){
+            int token = *in++;
+            int literal = token >> 4;
+
+            if (literal == 15){
+                int val = 255;
+                while (val == 255){
+                    if (in >= end) return -1;
+                    literal += (val = *in++);
+                }
+            }
+            if (literal > end - in || literal > cap - out){
+                return -1;
+            }
+
+            memcpy(dst + out, in, literal);
+            in += literal;
+            out += literal;
+
+            // 最后一个序列只有字面量
+            if (in == end){
+                break;
+            }
+            if (end - in < 2){
+                return -1;
+            }
+
+            int offset = in[0] | (in[1] << 8);
+            int match = (token & 15) + MIN_MATCH;
+
+            in += 2;
+
+            if ((token & 15) == 15){
+                int val = 255;
+                while (val == 255){
+                    if (in >= end) return -1;
+                    match += (val = *in++);
+                }
+            }
+            if (offset == 0 || offset > out || match > cap - out){
+                return -1;
+            }
+
+            // 匹配可能与输出重叠,需要逐字节复制
+            for (int i = 0; i < match; i++, out++){
+                dst[out] = dst[out - offset];
+            }
+        }
+
+        return out;
+    }
+
+protected:
+    static const char* Magic(){
+        return "\x00\xC5LZ";
+    }
+
+    static int64 GetMicrosecond(){
+        return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // 编码、解码的输出缓冲区
+    static string& Buffer(){
+        static thread_local string buffer;
+        return buffer;
+    }
+
+    // 压缩使用的哈希表(保存位置+1)
+    static vector<int>& Table(){
+        static thread_local vector<int> table(1 << HASH_BITS);
+        return table;
+    }
+
+    static u_int32 Read32(const u_char* data){
+        u_int32 val;
+        memcpy(&val, data, sizeof(val));
+        return val;
+    }
+
+    // 写入一个序列:字面量 + 匹配(match为0表示只有字面量)
+    static int WriteSequence(char* dst, int out, int cap, const u_char* literal, int literalLen, int offset, int match){
+        int ml = match > 0 ? match - MIN_MATCH : 0;
+        int need = 1 + literalLen + literalLen / 255 + 1 + (match > 0 ? 2 + ml / 255 + 1 : 0);
+
+        if (out + need > cap){
+            return -1;
+        }
+
+        u_char* token = (u_char*)(dst + out++);
+
+        *token = (u_char)((literalLen >= 15 ? 15 : literalLen) << 4);
+
+        if (literalLen >= 15){
+            int val = literalLen - 15;
+            for (; val >= 255; val -= 255) dst[out++] = (char)(255);
+            dst[out++] = (char)(val);
+        }
+
+        memcpy(dst + out, literal, literalLen);
+        out += literalLen;
+
+        if (match == 0){
+            return out;
+        }
+
+        dst[out++] = (char)(offset & 0xFF);
+        dst[out++] = (char)(offset >> 8);
+
+        *token |= (u_char)(ml >= 15 ? 15 : ml);
+
+        if (ml >= 15){
+            int val = ml - 15;
+            for (; val >= 255; val -= 255) dst[out++] = (char)(255);
+            dst[out++] = (char)(val);
+        }
+
+        return out;
+    }
+
+protected:
+    atomic<int> threshold;  // 压缩阈值,小于该长度的值不压缩
+    atomic<int> maxSize;    // 解压长度上限
+};
+
+#endif
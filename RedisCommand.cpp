@@ -1,4 +1,7 @@
 #include "RedisConn.h"
+#include <deque>
+#include <thread>
+#include <condition_variable>
 
 #define ColorPrint(__COLOR__, __FMT__, ...)		\
 SetConsoleTextColor(__COLOR__);					\
@@ -41,29 +44,1090 @@ bool CheckCommand(const char* fmt, ...)
 	return false;
 }
 
+// 把一行文本按空白拆分为命令参数,支持"..."(可以使用\n \r \t \" \\ \xHH等转义)与'...'(只能转义\'),引号不匹配时返回false
+bool SplitArgs(const char* str, const char* end, RedisConnect::Command& cmd)
+{
+	while (true)
+	{
+		while (str < end && isspace((u_char)(*str))) str++;
+
+		if (str >= end) return true;
+
+		string arg;
+		char quote = *str;
+
+		if (quote == '"')
+		{
+			while (true)
+			{
+				if (++str >= end) return false;
+				if (*str == '"') break;
+				if (*str == '\\' && str + 1 < end)
+				{
+					switch (*++str)
+					{
+					case 'n': arg += '\n'; break;
+					case 'r': arg += '\r'; break;
+					case 't': arg += '\t'; break;
+					case 'b': arg += '\b'; break;
+					case 'a': arg += '\a'; break;
+					case 'x':
+						if (str + 2 < end && isxdigit((u_char)(str[1])) && isxdigit((u_char)(str[2])))
+						{
+							arg += (char)(strtol(string(str + 1, 2).c_str(), NULL, 16));
+							str += 2;
+						}
+						else
+						{
+							arg += 'x';
+						}
+						break;
+					default: arg += *str; break;
+					}
+				}
+				else
+				{
+					arg += *str;
+				}
+			}
+			str++;
+		}
+		else if (quote == '\'')
+		{
+			while (true)
+			{
+				if (++str >= end) return false;
+				if (*str == '\'') break;
+				if (*str == '\\' && str + 1 < end && str[1] == '\'') str++;
+				arg += *str;
+			}
+			str++;
+		}
+		else
+		{
+			const char* pos = str;
+			while (str < end && !isspace((u_char)(*str))) str++;
+			arg.assign(pos, str);
+		}
+
+		// 右引号后面必须是空白或行尾
+		if (str < end && !isspace((u_char)(*str))) return false;
+
+		cmd.add(arg);
+	}
+}
+
+// 批量导入(--pipe)的输入,每个命令可以是RESP数组,也可以是一行以空白分隔的参数(见SplitArgs)
+class PipeInput
+{
+public:
+	PipeInput(FILE* fp) : fp(fp), pos(0), line(1), eof(false)
+	{
+	}
+
+	// 读取一个命令并按RESP格式追加到out,返回1表示成功,0表示输入结束,小于0表示格式错误
+	int next(string& out)
+	{
+		while (true)
+		{
+			// 跳过空白与空行
+			while (pos < data.size() && isspace((u_char)(data[pos])))
+			{
+				if (data[pos++] == '\n') line++;
+			}
+			if (pos < data.size()) break;
+			if (!fill()) return 0;
+		}
+
+		// RESP格式的命令原样转发,只需要确认数据完整
+		if (data[pos] == '*')
+		{
+			while (true)
+			{
+				const char* end = NULL;
+				const char* str = data.c_str() + pos;
+				int res = RedisConnect::ParseReply(str, data.c_str() + data.size(), end, NULL);
+
+				if (res >= 0)
+				{
+					line += std::count(str, end, '\n');
+					out.append(str, end);
+					pos = end - data.c_str();
+
+					return 1;
+				}
+
+				if (res != RedisConnect::TIMEOUT || !fill()) return RedisConnect::DATAERR;
+			}
+		}
+
+		size_t end = data.find('\n', pos);
+
+		while (end == string::npos && fill())
+		{
+			end = data.find('\n', pos);
+		}
+
+		if (end == string::npos) end = data.size();
+
+		RedisConnect::Command cmd;
+
+		if (!SplitArgs(data.c_str() + pos, data.c_str() + end, cmd)) return RedisConnect::DATAERR;
+
+		out += cmd.toString();
+		pos = end;
+
+		return 1;
+	}
+
+	// 当前所在的行号(用于提示格式错误的位置)
+	int64 getLine() const
+	{
+		return line;
+	}
+
+protected:
+	bool fill()
+	{
+		char buffer[64 * 1024];
+
+		if (eof) return false;
+
+		// 已经处理的数据不再保留
+		data.erase(0, pos);
+		pos = 0;
+
+		size_t len = fread(buffer, 1, sizeof(buffer), fp);
+
+		if (len == 0)
+		{
+			eof = true;
+			return false;
+		}
+
+		data.append(buffer, len);
+
+		return true;
+	}
+
+protected:
+	FILE* fp;
+	string data;
+	size_t pos;
+	int64 line;
+	bool eof;
+};
+
+// 批量发送的统计,多个连接同时发送时共用
+struct PipeStat
+{
+	atomic<int64> sent;  // 已发送的命令数
+	atomic<int64> replies;  // 收到的回复数
+	atomic<int64> errors;  // 错误回复数
+
+	PipeStat() : sent(0), replies(0), errors(0)
+	{
+	}
+};
+
+// 在一个连接上连续发送next产生的命令(next返回1表示追加了一个命令,0表示结束,小于0表示错误),
+// 最多window个命令等待回复,边发送边统计回复与错误.next出错时仍然等待已发送命令的回复,然后返回next的错误码
+int PipeCommands(RedisConnect* redis, const function<int(string&)>& next, int window, int timeout, PipeStat& stat)
+{
+	int res = 0;
+	int pos = 0;
+	int readed = 0;
+	int64 sent = 0;
+	int64 queued = 0;
+	int64 replies = 0;
+	string data;
+	vector<char> buffer(1024 * 1024);
+
+	// 统计已经收到的回复,未完成的命令多于limit个时等待回复
+	auto recvReply = [&](int64 limit){
+		int delay = 0;
+
+		while (true)
+		{
+			while (pos < readed)
+			{
+				const char* end = NULL;
+				const char* msg = &buffer[pos];
+				int ret = RedisConnect::ParseReply(msg, &buffer[0] + readed, end, NULL);
+
+				if (ret == RedisConnect::TIMEOUT) break;
+				if (ret < 0) return ret;
+
+				// 只打印前面的错误,避免大量相同的错误刷屏
+				if (*msg == '-' && ++stat.errors <= 10)
+				{
+					ColorPrint(eRED, "第%lld个命令执行失败[%s]\n", (long long)(replies + 1), string(msg + 1, end - 2).c_str());
+				}
+
+				pos = end - &buffer[0];
+				++stat.replies;
+				replies++;
+			}
+
+			// 没有需要等待的回复并且暂时没有数据可读
+			if (sent - replies <= limit && RedisConnect::WaitReadable(redis->getSocket(), INVALID_SOCKET, 0) == 0)
+			{
+				return (int)(RedisConnect::OK);
+			}
+
+			if (pos > 0)
+			{
+				memmove(&buffer[0], &buffer[pos], readed - pos);
+				readed -= pos;
+				pos = 0;
+			}
+
+			// 单个回复超过缓冲区大小时扩大缓冲区
+			if (readed >= (int)(buffer.size())) buffer.resize(buffer.size() * 2);
+
+			int len = redis->read(&buffer[readed], buffer.size() - readed, false);
+
+			if (len < 0)
+			{
+				if (len != RedisConnect::TIMEOUT) return len;
+				if ((delay += RedisConnect::SOCKET_TIMEOUT) > timeout) return len;
+				continue;
+			}
+
+			delay = 0;
+			readed += len;
+		}
+	};
+
+	auto flush = [&](int64 limit){
+		if (data.size() > 0)
+		{
+			if (redis->write(data.c_str(), data.size()) < 0) return (int)(RedisConnect::NETERR);
+
+			stat.sent += queued;
+			sent += queued;
+			queued = 0;
+			data.clear();
+		}
+
+		return recvReply(limit);
+	};
+
+	while ((res = next(data)) > 0)
+	{
+		// 积累的数据足够多或达到窗口上限时发送,窗口已满时等待一半的命令完成
+		if (++queued + sent - replies >= window)
+		{
+			res = flush(window / 2);
+		}
+		else if (data.size() >= 64 * 1024)
+		{
+			res = flush(window);
+		}
+
+		if (res < 0) return res;
+	}
+
+	int ret = flush(0);
+
+	return ret < 0 ? ret : res;
+}
+
+// 每秒调用一次print(参数为已运行的秒数)打印进度,直到running为0
+void PrintProgress(const atomic<int>& running, const function<void(double)>& print)
+{
+	auto stime = chrono::steady_clock::now();
+	auto next = stime + chrono::seconds(1);
+
+	while (running > 0)
+	{
+		Sleep(10);
+
+		if (chrono::steady_clock::now() < next) continue;
+
+		next += chrono::seconds(1);
+		print(chrono::duration<double>(chrono::steady_clock::now() - stime).count());
+	}
+}
+
+// 创建一个新的连接,memsz为接收缓冲区大小(单个回复不能超过缓冲区大小)
+shared_ptr<RedisConnect> ConnectRedis(const char* host, int port, const char* passwd, int memsz = 2 * 1024 * 1024)
+{
+	shared_ptr<RedisConnect> redis = make_shared<RedisConnect>();
+
+	if (!redis->connectRedis(host, port, 3000, memsz) || (passwd && *passwd && redis->auth(passwd) < 0))
+	{
+		ColorPrint(eRED, "REDIS[%s][%d]连接失败\n", host, port);
+		return NULL;
+	}
+
+	return redis;
+}
+
+// 批量导入:从文件或标准输入读取命令,在一个连接上连续发送(最多window个命令等待回复),边发送边统计回复与错误
+int RunPipe(RedisConnect* redis, const char* path, int window, int timeout)
+{
+	FILE* fp = path ? fopen(path, "rb") : stdin;
+
+	if (fp == NULL)
+	{
+		ColorPrint(eRED, "打开文件[%s]失败\n", path);
+		return -1;
+	}
+
+	int res = 0;
+	PipeStat stat;
+	PipeInput input(fp);
+	atomic<int> running(1);
+	auto stime = chrono::steady_clock::now();
+
+	std::thread worker([&](){
+		res = PipeCommands(redis, [&](string& data){
+			return input.next(data);
+		}, window, timeout, stat);
+
+		--running;
+	});
+
+	PrintProgress(running, [&](double sec){
+		ColorPrint(eWHITE, "已发送%lld个命令,收到%lld个回复,其中错误%lld个,%.0f个/秒\n", (long long)(stat.sent.load()), (long long)(stat.replies.load()), (long long)(stat.errors.load()), stat.replies / sec);
+	});
+
+	worker.join();
+
+	if (path) fclose(fp);
+
+	if (res == RedisConnect::DATAERR)
+	{
+		ColorPrint(eRED, "输入格式错误(第%lld行)\n", (long long)(input.getLine()));
+	}
+	else if (res < 0)
+	{
+		ColorPrint(eRED, "发送命令或接收回复失败[%d]\n", res);
+	}
+
+	double etime = chrono::duration<double>(chrono::steady_clock::now() - stime).count();
+
+	ColorPrint(eWHITE, "共发送%lld个命令,收到%lld个回复,其中错误%lld个,耗时%.3f秒(%.0f个/秒)\n", (long long)(stat.sent.load()), (long long)(stat.replies.load()), (long long)(stat.errors.load()), etime, stat.replies / max(etime, 0.001));
+
+	return res < 0 ? -1 : (stat.errors > 0 ? 1 : 0);
+}
+
+// 耗时分布(微秒),第i个桶统计[2^(i-1), 2^i)微秒,最后一个桶包含更大的值
+struct LatencyHistogram
+{
+	static const int BUCKETS = 24;
+
+	int64 buckets[BUCKETS];
+	int64 count;
+	int64 sum;
+	int64 min;
+	int64 max;
+
+	LatencyHistogram()
+	{
+		clear();
+	}
+
+	void clear()
+	{
+		memset(buckets, 0, sizeof(buckets));
+		count = sum = min = max = 0;
+	}
+
+	void add(int64 us)
+	{
+		int idx = 0;
+
+		while (idx < BUCKETS - 1 && ((int64)(1) << idx) <= us) idx++;
+
+		if (count == 0 || us < min) min = us;
+		if (us > max) max = us;
+
+		buckets[idx]++;
+		count++;
+		sum += us;
+	}
+
+	void merge(const LatencyHistogram& obj)
+	{
+		if (obj.count == 0) return;
+		if (count == 0 || obj.min < min) min = obj.min;
+		if (obj.max > max) max = obj.max;
+
+		for (int i = 0; i < BUCKETS; i++) buckets[i] += obj.buckets[i];
+
+		count += obj.count;
+		sum += obj.sum;
+	}
+
+	double mean() const
+	{
+		return count > 0 ? (double)(sum) / count : 0;
+	}
+
+	// 百分位数(返回所在桶的上限,不超过max)
+	int64 percentile(double p) const
+	{
+		int64 num = 0;
+
+		for (int i = 0; i < BUCKETS; i++)
+		{
+			if ((num += buckets[i]) >= count * p) return std::min((int64)(1) << i, max);
+		}
+
+		return max;
+	}
+
+	// 每个桶打印一行,用星号的数量表示样本所占的比例
+	void print() const
+	{
+		for (int i = 0; i < BUCKETS; i++)
+		{
+			if (buckets[i] == 0) continue;
+
+			int len = (int)(buckets[i] * 50 / count);
+
+			ColorPrint(eWHITE, "  <%9.3fms %6.2f%% ", ((int64)(1) << i) / 1000.0, buckets[i] * 100.0 / count);
+			ColorPrint(eGREEN, "%s\n", string(std::max(len, 1), '*').c_str());
+		}
+	}
+};
+
+static volatile bool stopped = false;
+
+// 延迟监测:每隔interval毫秒执行一次PING,每秒打印累计与最近history秒的延迟,每history秒打印一次最近的延迟分布,count为0时持续到Ctrl+C
+int RunLatency(RedisConnect* redis, int interval, int64 count, int history)
+{
+	int seconds = 0;
+	int64 errors = 0;
+	int64 samples = 0;
+	LatencyHistogram total;
+	LatencyHistogram current;
+	deque<LatencyHistogram> recent;
+	auto next = chrono::steady_clock::now() + chrono::seconds(1);
+
+	signal(SIGINT, [](int){ stopped = true; });
+
+	auto print = [&](bool histogram){
+		LatencyHistogram stat;
+
+		for (const auto& item : recent) stat.merge(item);
+
+		ColorPrint(eWHITE, "min: %.3f, max: %.3f, avg: %.3f (%lld个样本, %lld个错误)", total.min / 1000.0, total.max / 1000.0, total.mean() / 1000.0, (long long)(total.count), (long long)(errors));
+		ColorPrint(eGREEN, " 最近%d秒 p50: %.3f, p99: %.3f, max: %.3f\n", (int)(recent.size()), stat.percentile(0.5) / 1000.0, stat.percentile(0.99) / 1000.0, stat.max / 1000.0);
+
+		if (histogram)
+		{
+			ColorPrint(eWHITE, "最近%d秒的延迟分布:\n", (int)(recent.size()));
+			stat.print();
+		}
+	};
+
+	while (!stopped && (count <= 0 || samples < count))
+	{
+		auto stime = chrono::steady_clock::now();
+
+		if (redis->ping() < 0)
+		{
+			if (++errors <= 10)
+			{
+				ColorPrint(eRED, "执行PING失败[%d][%s]\n", redis->getErrorCode(), redis->getErrorString().c_str());
+			}
+
+			redis->reconnect();
+		}
+		else
+		{
+			int64 us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - stime).count();
+
+			total.add(us);
+			current.add(us);
+		}
+
+		samples++;
+
+		if (chrono::steady_clock::now() >= next)
+		{
+			next += chrono::seconds(1);
+			recent.push_back(current);
+			current.clear();
+
+			if ((int)(recent.size()) > history) recent.pop_front();
+
+			print(++seconds % history == 0);
+		}
+
+		if (interval > 0) Sleep(interval);
+	}
+
+	if (current.count > 0)
+	{
+		recent.push_back(current);
+
+		if ((int)(recent.size()) > history) recent.pop_front();
+	}
+
+	print(true);
+
+	return errors > 0 ? 1 : 0;
+}
+
+// 压力测试的参数
+struct BenchOption
+{
+	int threads;  // 线程数
+	int conns;  // 每个线程的连接数
+	int pipeline;  // 每个连接每次发送的命令数
+	int keyspace;  // 随机键的个数
+	int size;  // 值的字节数
+	int duration;  // 运行的秒数,大于0时忽略requests
+	int64 requests;  // 总请求数
+	vector<pair<string, int>> mix;  // 命令与权重
+};
+
+// 解析命令组合,如"get:8,set:2",省略权重时为1
+bool ParseBenchMix(const string& str, vector<pair<string, int>>& mix)
+{
+	static const char* names[] = {"ping", "get", "set", "incr", "hget", "hset", "lpush", "rpop", "sadd", "zadd"};
+	size_t pos = 0;
+
+	mix.clear();
+
+	while (pos < str.size())
+	{
+		size_t tail = str.find(',', pos);
+
+		if (tail == string::npos) tail = str.size();
+
+		string name = str.substr(pos, tail - pos);
+		size_t idx = name.find(':');
+		int weight = idx == string::npos ? 1 : atoi(name.c_str() + idx + 1);
+
+		name = name.substr(0, idx);
+		std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+		if (weight <= 0 || std::find_if(begin(names), end(names), [&](const char* item){ return name == item; }) == end(names)) return false;
+
+		mix.push_back(make_pair(name, weight));
+		pos = tail + 1;
+	}
+
+	return mix.size() > 0;
+}
+
+// 按命令名称生成一个测试命令,key为随机选择的键
+void MakeBenchCommand(RedisConnect::Command& cmd, const string& name, const string& key, const string& val)
+{
+	cmd = RedisConnect::Command(name);
+
+	if (name == "get" || name == "incr")
+	{
+		cmd.add(key);
+	}
+	else if (name == "set")
+	{
+		cmd.add(key, val);
+	}
+	else if (name == "hget")
+	{
+		cmd.add("bench:hash", key);
+	}
+	else if (name == "hset")
+	{
+		cmd.add("bench:hash", key, val);
+	}
+	else if (name == "lpush" || name == "sadd")
+	{
+		cmd.add(name == "lpush" ? "bench:list" : "bench:set", val);
+	}
+	else if (name == "rpop")
+	{
+		cmd.add("bench:list");
+	}
+	else if (name == "zadd")
+	{
+		cmd.add("bench:zset", (int)(key.size()), key);
+	}
+}
+
+// 压力测试:threads个线程,每个线程使用conns个连接,每个连接每次发送pipeline个命令,
+// 先在所有连接上发送再依次接收回复,打印每秒的吞吐量与结束时的延迟分布(每个请求从所在批次发出到收到自己的回复)
+int RunBench(const char* host, int port, const char* passwd, const BenchOption& opt)
+{
+	atomic<int64> remain(opt.duration > 0 ? INT64_MAX : opt.requests);
+	atomic<int64> finished(0);
+	atomic<int64> errors(0);
+	atomic<int> running(opt.threads);
+	vector<LatencyHistogram> costs(opt.threads);
+	vector<std::thread> workers;
+	int total = 0;
+
+	for (const auto& item : opt.mix) total += item.second;
+
+	auto stime = chrono::steady_clock::now();
+	auto etime = stime + chrono::seconds(opt.duration);
+
+	stopped = false;
+	signal(SIGINT, [](int){ stopped = true; });
+
+	for (int i = 0; i < opt.threads; i++)
+	{
+		workers.push_back(std::thread([&, i](){
+			u_int32 seed = (u_int32)(i + 1) * 2654435761U;
+			string val(opt.size, 'x');
+			vector<int> counts(opt.conns);
+			vector<int64> starts(opt.conns);
+			vector<shared_ptr<RedisConnect>> conns;
+			RedisConnect::Command cmd;
+			string data;
+
+			auto random = [&](){
+				seed ^= seed << 13;
+				seed ^= seed >> 17;
+				seed ^= seed << 5;
+				return seed;
+			};
+
+			auto now = [](){
+				return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+			};
+
+			for (int j = 0; j < opt.conns; j++)
+			{
+				shared_ptr<RedisConnect> redis = ConnectRedis(host, port, passwd);
+
+				if (!redis)
+				{
+					stopped = true;
+					break;
+				}
+
+				conns.push_back(redis);
+			}
+
+			while (!stopped && (int)(conns.size()) == opt.conns)
+			{
+				if (opt.duration > 0 && chrono::steady_clock::now() >= etime) break;
+
+				int sent = 0;
+
+				for (int j = 0; j < opt.conns; j++)
+				{
+					int64 num = min((int64)(opt.pipeline), remain.fetch_sub(opt.pipeline));
+
+					counts[j] = (int)(max(num, (int64)(0)));
+
+					if (counts[j] == 0) continue;
+
+					data.clear();
+
+					for (int k = 0; k < counts[j]; k++)
+					{
+						int weight = (int)(random() % total);
+						auto it = opt.mix.begin();
+
+						while ((weight -= it->second) >= 0) ++it;
+
+						MakeBenchCommand(cmd, it->first, "bench:key:" + to_string(random() % opt.keyspace), val);
+						data += cmd.toString();
+					}
+
+					starts[j] = now();
+
+					if (conns[j]->write(data.c_str(), data.size()) < 0)
+					{
+						errors += counts[j];
+						counts[j] = 0;
+						conns[j]->reconnect();
+						continue;
+					}
+
+					sent += counts[j];
+				}
+
+				if (sent == 0) break;
+
+				for (int j = 0; j < opt.conns; j++)
+				{
+					if (counts[j] == 0) continue;
+
+					int res = conns[j]->recvReply(counts[j], [&](const char* msg, const char*){
+						costs[i].add(now() - starts[j]);
+
+						if (*msg == '-') ++errors;
+					}, 3000);
+
+					if (res < 0)
+					{
+						errors += counts[j];
+						conns[j]->reconnect();
+						continue;
+					}
+
+					finished += counts[j];
+				}
+			}
+
+			--running;
+		}));
+	}
+
+	int64 last = 0;
+
+	PrintProgress(running, [&](double sec){
+		int64 num = finished;
+
+		ColorPrint(eWHITE, "%.0f秒: 已完成%lld个请求, %lld个/秒, 错误%lld个\n", sec, (long long)(num), (long long)(num - last), (long long)(errors.load()));
+		last = num;
+	});
+
+	for (auto& item : workers) item.join();
+
+	double sec = chrono::duration<double>(chrono::steady_clock::now() - stime).count();
+	LatencyHistogram hist;
+
+	for (auto& item : costs) hist.merge(item);
+
+	// 百分位数为所在桶(按2的幂划分)的上限
+	auto percentile = [&](double p){
+		return hist.percentile(p) / 1000.0;
+	};
+
+	ColorPrint(eWHITE, "%s\n", "--------------------------------------");
+	ColorPrint(eWHITE, "线程%d个, 每个线程%d个连接, 每批%d个命令, 共%lld个请求, 错误%lld个, 耗时%.3f秒\n", opt.threads, opt.conns, opt.pipeline, (long long)(finished.load()), (long long)(errors.load()), sec);
+	ColorPrint(eGREEN, "吞吐量: %.0f个/秒\n", finished / std::max(sec, 0.001));
+	ColorPrint(eGREEN, "请求延迟(ms, 每批%d个命令): p50 %.3f, p90 %.3f, p99 %.3f, p99.9 %.3f, max %.3f, 平均 %.3f\n", opt.pipeline, percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999), hist.max / 1000.0, hist.mean() / 1000.0);
+
+	return errors > 0 ? 1 : 0;
+}
+
+// 导出文件的格式:文件头DUMP_MAGIC,然后是连续的记录,每条记录为
+// 键长度(4字节) + 键 + DUMP数据长度(4字节) + DUMP数据 + 剩余有效时间(8字节,毫秒,-1表示永久),整数均为小端字节序
+static const char DUMP_MAGIC[] = "RCDUMP01";
+
+void AppendInteger(string& out, u_int64 val, int len)
+{
+	for (int i = 0; i < len; i++) out += (char)((val >> (i * 8)) & 0xFF);
+}
+
+bool ReadInteger(FILE* fp, u_int64& val, int len)
+{
+	u_char buffer[8];
+
+	if (fread(buffer, 1, len, fp) != (size_t)(len)) return false;
+
+	val = 0;
+
+	for (int i = 0; i < len; i++) val |= (u_int64)(buffer[i]) << (i * 8);
+
+	return true;
+}
+
+// 导出:用SCAN遍历匹配pattern的键,conns个连接同时用流水线执行DUMP/PTTL,结果写入文件
+int RunExport(RedisConnect* redis, const char* host, int port, const char* passwd, const char* path, const string& pattern, int conns, int batch, int memsz)
+{
+	FILE* fp = fopen(path, "wb");
+
+	if (fp == NULL)
+	{
+		ColorPrint(eRED, "创建文件[%s]失败\n", path);
+		return -1;
+	}
+
+	fwrite(DUMP_MAGIC, 1, sizeof(DUMP_MAGIC) - 1, fp);
+
+	int res = 0;
+	bool scanned = false;
+	std::mutex mtx;
+	std::mutex fileMtx;
+	condition_variable cv;
+	deque<vector<string>> tasks;
+	atomic<int> running(conns);
+	atomic<int64> keys(0);
+	atomic<int64> bytes(0);
+	atomic<int64> errors(0);
+	atomic<int64> scanCount(0);
+	vector<std::thread> workers;
+	auto stime = chrono::steady_clock::now();
+
+	for (int i = 0; i < conns; i++)
+	{
+		workers.push_back(std::thread([&](){
+			shared_ptr<RedisConnect> conn = ConnectRedis(host, port, passwd, memsz);
+			vector<RedisConnect::Reply> replies;
+			vector<RedisConnect::Command> cmds;
+			vector<string> task;
+			string data;
+
+			while (true)
+			{
+				{
+					unique_lock<std::mutex> lk(mtx);
+
+					cv.wait(lk, [&](){ return scanned || tasks.size() > 0; });
+
+					if (tasks.empty()) break;
+
+					task.swap(tasks.front());
+					tasks.pop_front();
+				}
+
+				cv.notify_all();
+
+				if (!conn)
+				{
+					errors += task.size();
+					continue;
+				}
+
+				cmds.clear();
+
+				for (const string& key : task)
+				{
+					cmds.push_back(RedisConnect::Command("dump"));
+					cmds.back().add(key);
+					cmds.push_back(RedisConnect::Command("pttl"));
+					cmds.back().add(key);
+				}
+
+				if (conn->pipeline(cmds, replies) < 0)
+				{
+					if (++errors <= 10)
+					{
+						ColorPrint(eRED, "执行DUMP失败[%d][%s]\n", conn->getErrorCode(), conn->getErrorString().c_str());
+					}
+
+					errors += task.size() - 1;
+					conn->reconnect();
+					continue;
+				}
+
+				data.clear();
+
+				for (size_t j = 0; j < task.size(); j++)
+				{
+					const RedisConnect::Reply& value = replies[j * 2];
+					const RedisConnect::Reply& ttl = replies[j * 2 + 1];
+
+					// 扫描之后被删除或已经过期的键
+					if (value.isNull() || value.isError() || ttl.integer == -2) continue;
+
+					AppendInteger(data, task[j].size(), 4);
+					data += task[j];
+					AppendInteger(data, value.str.size(), 4);
+					data += value.str;
+					AppendInteger(data, (u_int64)(ttl.integer < 0 ? -1 : ttl.integer), 8);
+					++keys;
+				}
+
+				lock_guard<std::mutex> lk(fileMtx);
+
+				fwrite(data.c_str(), 1, data.size(), fp);
+				bytes += data.size();
+			}
+
+			--running;
+		}));
+	}
+
+	// 扫描在单独的线程中执行,待处理的批次过多时等待工作线程
+	std::thread scanner([&](){
+		string cursor = "0";
+		RedisConnect::Reply reply;
+
+		do
+		{
+			RedisConnect::Command cmd("scan");
+
+			cmd.add(cursor, "match", pattern, "count", batch);
+
+			if ((res = redis->execute(cmd, reply)) < 0 || reply.elements.size() != 2)
+			{
+				ColorPrint(eRED, "执行SCAN失败[%d][%s]\n", res, redis->getErrorString().c_str());
+				res = res < 0 ? res : (int)(RedisConnect::DATAERR);
+				break;
+			}
+
+			vector<string> task;
+
+			cursor = reply.elements[0].str;
+
+			for (const auto& item : reply.elements[1].elements) task.push_back(item.str);
+
+			if (task.empty()) continue;
+
+			scanCount += task.size();
+
+			unique_lock<std::mutex> lk(mtx);
+
+			cv.wait(lk, [&](){ return (int)(tasks.size()) < conns * 4; });
+			tasks.push_back(std::move(task));
+			cv.notify_all();
+		} while (cursor != "0");
+
+		{
+			lock_guard<std::mutex> lk(mtx);
+			scanned = true;
+		}
+
+		cv.notify_all();
+	});
+
+	PrintProgress(running, [&](double sec){
+		ColorPrint(eWHITE, "已扫描%lld个键,导出%lld个键(%.1fMB),错误%lld个,%.0f个/秒\n", (long long)(scanCount.load()), (long long)(keys.load()), bytes / 1048576.0, (long long)(errors.load()), keys / sec);
+	});
+
+	scanner.join();
+
+	for (auto& item : workers) item.join();
+
+	fclose(fp);
+
+	double sec = max(chrono::duration<double>(chrono::steady_clock::now() - stime).count(), 0.001);
+
+	ColorPrint(eWHITE, "共导出%lld个键(%.1fMB),错误%lld个,耗时%.3f秒(%.0f个/秒)\n", (long long)(keys.load()), bytes / 1048576.0, (long long)(errors.load()), sec, keys / sec);
+
+	return res < 0 ? -1 : (errors > 0 ? 1 : 0);
+}
+
+// 导入:读取export导出的文件,conns个连接同时用流水线执行RESTORE(每个连接最多window个命令等待回复),replace为true时覆盖已有的键
+int RunImport(const char* host, int port, const char* passwd, const char* path, int conns, int window, bool replace)
+{
+	FILE* fp = fopen(path, "rb");
+	char magic[sizeof(DUMP_MAGIC) - 1];
+
+	if (fp == NULL)
+	{
+		ColorPrint(eRED, "打开文件[%s]失败\n", path);
+		return -1;
+	}
+
+	if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) || memcmp(magic, DUMP_MAGIC, sizeof(magic)))
+	{
+		ColorPrint(eRED, "文件[%s]不是导出文件\n", path);
+		fclose(fp);
+		return -1;
+	}
+
+	int res = 0;
+	PipeStat stat;
+	std::mutex mtx;
+	atomic<int> running(conns);
+	vector<std::thread> workers;
+	auto stime = chrono::steady_clock::now();
+
+	// 读取一条记录并生成RESTORE命令,多个连接共用同一个文件
+	auto next = [&](string& data){
+		u_int64 len = 0;
+		u_int64 ttl = 0;
+		string key;
+		string value;
+		lock_guard<std::mutex> lk(mtx);
+
+		if (!ReadInteger(fp, len, 4)) return feof(fp) ? 0 : (int)(RedisConnect::DATAERR);
+
+		key.resize(len);
+
+		if (fread(&key[0], 1, len, fp) != len || !ReadInteger(fp, len, 4)) return (int)(RedisConnect::DATAERR);
+
+		value.resize(len);
+
+		if (fread(&value[0], 1, len, fp) != len || !ReadInteger(fp, ttl, 8)) return (int)(RedisConnect::DATAERR);
+
+		RedisConnect::Command cmd("restore");
+
+		cmd.add(key, (int64)(ttl) < 0 ? 0 : (int64)(ttl), value);
+
+		if (replace) cmd.add("replace");
+
+		data += cmd.toString();
+
+		return 1;
+	};
+
+	for (int i = 0; i < conns; i++)
+	{
+		workers.push_back(std::thread([&](){
+			shared_ptr<RedisConnect> conn = ConnectRedis(host, port, passwd);
+			int ret = conn ? PipeCommands(conn.get(), next, window, 30000, stat) : (int)(RedisConnect::NETERR);
+
+			if (ret < 0)
+			{
+				lock_guard<std::mutex> lk(mtx);
+				res = res < 0 ? res : ret;
+			}
+
+			--running;
+		}));
+	}
+
+	PrintProgress(running, [&](double sec){
+		ColorPrint(eWHITE, "已导入%lld个键,错误%lld个,%.0f个/秒\n", (long long)(stat.replies - stat.errors), (long long)(stat.errors.load()), stat.replies / sec);
+	});
+
+	for (auto& item : workers) item.join();
+
+	fclose(fp);
+
+	if (res == RedisConnect::DATAERR)
+	{
+		ColorPrint(eRED, "文件[%s]格式错误\n", path);
+	}
+	else if (res < 0)
+	{
+		ColorPrint(eRED, "发送命令或接收回复失败[%d]\n", res);
+	}
+
+	double sec = max(chrono::duration<double>(chrono::steady_clock::now() - stime).count(), 0.001);
+
+	ColorPrint(eWHITE, "共导入%lld个键,错误%lld个,耗时%.3f秒(%.0f个/秒)\n", (long long)(stat.replies - stat.errors), (long long)(stat.errors.load()), sec, stat.replies / sec);
+
+	return res < 0 ? -1 : (stat.errors > 0 ? 1 : 0);
+}
+
 int main(int argc, char** argv)
 {
 	auto GetCmdParam = [&](int idx){
 		return idx < argc ? argv[idx] : NULL;
 	};
+
+	// 获取"--name value"形式的选项,不存在时返回def
+	auto GetCmdOption = [&](const char* name, const char* def){
+		for (int i = 2; i + 1 < argc; i++)
+		{
+			if (strcmp(argv[i], name) == 0) return (const char*)(argv[i + 1]);
+		}
+		return def;
+	};
+
+	// 是否指定了没有值的选项(如--replace)
+	auto HasCmdOption = [&](const char* name){
+		for (int i = 2; i < argc; i++)
+		{
+			if (strcmp(argv[i], name) == 0) return true;
+		}
+		return false;
+	};
 	
 	string val;
-	RedisConnect* redis;
+	RedisConnect conn;
+	RedisConnect* redis = &conn;
 	const char* ptr = NULL;  // redis
 	const char* cmd = GetCmdParam(1);  // 命令
 	const char* key = GetCmdParam(2);  // 键值
 	//const char* field = GetCmdParam(3); // 没用到
 
-	// host = 127.0.0.1:6379
+	// host = 127.0.0.1:6379 或 [::1]:6379 或 unix:/tmp/redis.sock
 	const char* host = getenv("REDIS_HOST"); // 获取环境变量host
 	int port = 6379;
 	// passwd = 123456
 	const char* passwd = getenv("REDIS_PASSWORD"); // 获取环境变量密码
 	
-	if (host)
+	if (host && !RedisConnect::IsUnixSocketPath(host))
 	{
-		// 查找':'第一次出现的位置,ptr = :6379
-		if (ptr = strchr(host, ':'))
+		// 查找':'最后一次出现的位置,ptr = :6379(IPv6地址需要写成[::1]:6379)
+		if ((ptr = strrchr(host, ':')) && (strchr(host, ':') == ptr || *(ptr - 1) == ']'))
 		{
 			// 127.0.0.1,相当于迭代器构造函数
 			static string shost(host, ptr);
@@ -90,7 +1154,71 @@ int main(int argc, char** argv)
 			return -1;
 		}
 
-		
+		// 批量导入:redis --pipe [--file 文件] [--window 最多等待回复的命令数] [--timeout 毫秒]
+		if (strcmp(cmd, "--pipe") == 0)
+		{
+			int window = max(atoi(GetCmdOption("--window", "10000")), 1);
+			int timeout = max(atoi(GetCmdOption("--timeout", "30000")), 1);
+
+			return RunPipe(redis, GetCmdOption("--file", NULL), window, timeout);
+		}
+
+		// 延迟监测:redis --latency [--interval 毫秒] [--count 次数] [--history 秒]
+		if (strcmp(cmd, "--latency") == 0)
+		{
+			int interval = atoi(GetCmdOption("--interval", "10"));
+			int history = max(atoi(GetCmdOption("--history", "15")), 1);
+
+			return RunLatency(redis, interval, atoll(GetCmdOption("--count", "0")), history);
+		}
+
+		// 压力测试:redis --bench [--threads 线程数] [--conns 每个线程的连接数] [--pipeline 每批命令数]
+		//          [--requests 总请求数] [--duration 秒] [--mix get:8,set:2] [--keyspace 键数] [--size 值字节数]
+		if (strcmp(cmd, "--bench") == 0)
+		{
+			BenchOption opt;
+
+			opt.threads = max(atoi(GetCmdOption("--threads", "1")), 1);
+			opt.conns = max(atoi(GetCmdOption("--conns", "1")), 1);
+			opt.pipeline = max(atoi(GetCmdOption("--pipeline", "1")), 1);
+			opt.keyspace = max(atoi(GetCmdOption("--keyspace", "100000")), 1);
+			opt.size = max(atoi(GetCmdOption("--size", "16")), 0);
+			opt.duration = atoi(GetCmdOption("--duration", "0"));
+			opt.requests = atoll(GetCmdOption("--requests", "100000"));
+
+			if (!ParseBenchMix(GetCmdOption("--mix", "get,set"), opt.mix))
+			{
+				ColorPrint(eRED, "%s\n", "命令组合格式错误(支持ping get set incr hget hset lpush rpop sadd zadd,如get:8,set:2)");
+				return -1;
+			}
+
+			return RunBench(host, port, passwd, opt);
+		}
+
+		// 导出:redis export --file 文件 [--match 模式] [--conns 连接数] [--batch 每批键数] [--buffer 单个值的最大MB数]
+		if (strcmp(cmd, "export") == 0 || strcmp(cmd, "import") == 0)
+		{
+			const char* path = GetCmdOption("--file", NULL);
+			int conns = max(atoi(GetCmdOption("--conns", "4")), 1);
+
+			if (path == NULL)
+			{
+				ColorPrint(eRED, "%s\n", "请使用--file参数指定文件");
+				return -1;
+			}
+
+			if (strcmp(cmd, "export") == 0)
+			{
+				int batch = max(atoi(GetCmdOption("--batch", "100")), 1);
+				int memsz = max(atoi(GetCmdOption("--buffer", "16")), 1) * 1024 * 1024;
+
+				return RunExport(redis, host, port, passwd, path, GetCmdOption("--match", "*"), conns, batch, memsz);
+			}
+
+			// 导入:redis import --file 文件 [--conns 连接数] [--window 每个连接最多等待回复的命令数] [--replace]
+			return RunImport(host, port, passwd, path, conns, max(atoi(GetCmdOption("--window", "1000")), 1), HasCmdOption("--replace"));
+		}
+
 		string tmp = cmd;
 		// 将命令所有字符变为大写
 		std::transform(tmp.begin(), tmp.end(), tmp.begin(), ::toupper);
@@ -3,12 +3,20 @@
 #include <errno.h>
 #include <netdb.h>
 #include <fcntl.h>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
 #include <vector>
 #include <string>
 #include <memory>
 #include <iostream>
+#include <functional>
 #include <signal.h>
+#include <cmath>
 #include <algorithm>
+#include <limits>
+#include <type_traits>
 #include <sys/time.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
@@ -16,12 +24,19 @@
 #include <sys/types.h>
 #include <sys/ioctl.h>
 #include <arpa/inet.h>
+#include <poll.h>
 #include <sys/epoll.h>
 #include <sys/statfs.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/syscall.h>
 #include "typedef.h"
+#include "RedisCodec.h"
+#include "RedisHotKey.h"
+#include "RedisNegCache.h"
+#include "RedisBreaker.h"
 
 using namespace std;
 
@@ -42,9 +57,38 @@ public:
 	static const int NETCLOSE = -10;  // 网络关闭
 	static const int NETDELAY = -11;  // 网络延迟
 	static const int AUTHFAIL = -12;  // 密码不对
+	static const int ABORTED = -13;  // 事务被放弃(WATCH的键被修改)
+	static const int CIRCUITOPEN = -14;  // 熔断打开,请求没有发送
 
 public:
     static const int SOCKET_TIMEOUT = 10;  // sokect超时
+    static const int DNS_CACHE_TIMEOUT = 60 * 1000;  // DNS缓存默认有效时间
+
+    // socket参数,连接成功后设置
+    struct SocketOption{
+        bool noDelay = true;   // TCP_NODELAY,关闭Nagle算法避免小包被延迟发送
+        int keepIdle = 0;      // 空闲多少秒后开始keepalive探测,0表示不开启keepalive
+        int keepIntvl = 0;     // keepalive探测间隔(秒)
+        int keepCnt = 0;       // keepalive探测失败多少次后断开
+        int sendBufSize = 0;   // SO_SNDBUF,0表示使用系统默认值
+        int recvBufSize = 0;   // SO_RCVBUF,0表示使用系统默认值
+        int busyPoll = 0;      // SO_BUSY_POLL忙轮询时间(微秒),0表示不开启
+    };
+
+    // 命令执行器:设置后命令不再由当前连接直接读写socket,而是交给执行器发送,
+    // 执行器按顺序对每个回复调用func(msg, end),最多等待timeout毫秒,返回OK或者错误码
+    class Executor{
+    public:
+        virtual ~Executor(){}
+        virtual int execute(const string& data, int count, const function<void(const char*, const char*)>& func, int timeout) = 0;
+    };
+
+    // 解析后的socket地址
+    struct SocketAddress{
+        int family;
+        socklen_t len;
+        struct sockaddr_storage addr;
+    };
 
 // Redis网络连接函数
 public:
@@ -84,27 +128,34 @@ public:
         return setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char*)(&tv), sizeof(tv)) == 0;
     }
 
-    // socket连接服务器
-	int SocketConnectTimeout(const char* ip, int port, int timeout){
+    // 是否为unix域套接字地址,格式为unix:/path/to/redis.sock
+    static bool IsUnixSocketPath(const char* host){
+        return strncmp(host, "unix:", 5) == 0;
+    }
+
+    // 以非阻塞方式连接指定地址,timeout毫秒内未连接成功则返回INVALID_SOCKET
+    int SocketConnectAddress(int family, const struct sockaddr* addr, socklen_t addrlen, int timeout){
         u_long mode = 1;
-        struct sockaddr_in addr;
-        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        int sock = socket(family, SOCK_STREAM, 0);
         if (sock < 0){
             return INVALID_SOCKET;
         }
-        addr.sin_family = AF_INET;
-        addr.sin_port = htons(port);
-        inet_pton(AF_INET, ip, &addr.sin_addr);
 
         // 设置套接字非阻塞，mode = 0表示清除，mode非0表示设置本套接口的非阻塞标志
         ioctl(sock, FIONBIO, &mode);
         mode = 0;
 
-        if (connect(sock, (struct sockaddr*)(&addr), sizeof(addr)) == 0){
+        if (connect(sock, addr, addrlen) == 0){
             ioctl(sock, FIONBIO, &mode);
             return sock;
         }
 
+        // 非阻塞connect只有EINPROGRESS(unix域套接字为EAGAIN)才需要等待
+        if (errno != EINPROGRESS && errno != EAGAIN){
+            SocketClose(sock);
+            return INVALID_SOCKET;
+        }
+
         struct epoll_event ev;
         struct epoll_event evs;
         int epollFd = epoll_create(1024);
@@ -134,10 +185,181 @@ public:
             }
         }
         close(epollFd);
-        
+        SocketClose(sock);
+
+        return INVALID_SOCKET;
+    }
+
+    // 获取单调递增的毫秒时间
+    static int64 GetMillisecond(){
+        return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // 设置DNS缓存有效时间(毫秒),0表示不缓存
+    static void SetDnsCacheTimeout(int timeout){
+        DnsCacheTimeout() = timeout;
+    }
+
+    static atomic<int>& DnsCacheTimeout(){
+        static atomic<int> timeout(DNS_CACHE_TIMEOUT);
+        return timeout;
+    }
+
+    // 通过getaddrinfo解析主机名(支持IPv6与[::1]写法),解析结果按DnsCacheTimeout缓存,
+    // 避免断线重连时大量连接同时查询DNS,解析失败时继续使用过期的缓存
+    static bool SocketResolve(const string& host, int port, vector<SocketAddress>& addrs){
+        struct DnsCache{
+            int64 etime;
+            vector<SocketAddress> addrs;
+        };
+        static mutex mtx;
+        static map<string, DnsCache> cache;
+
+        string name = host;
+        string key = host + "#" + to_string(port);
+        int64 now = GetMillisecond();
+
+        if (name.size() > 2 && name.front() == '[' && name.back() == ']'){
+            name = name.substr(1, name.size() - 2);
+        }
+
+        {
+            lock_guard<mutex> lk(mtx);
+            auto it = cache.find(key);
+            if (it != cache.end() && it->second.etime > now){
+                addrs = it->second.addrs;
+                return true;
+            }
+        }
+
+        struct addrinfo hints;
+        struct addrinfo* res = NULL;
+        string service = to_string(port);
+
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+
+        addrs.clear();
+
+        if (getaddrinfo(name.c_str(), service.c_str(), &hints, &res) == 0){
+            for (struct addrinfo* ai = res; ai; ai = ai->ai_next){
+                SocketAddress item;
+                if (ai->ai_addrlen > sizeof(item.addr)){
+                    continue;
+                }
+                memcpy(&item.addr, ai->ai_addr, ai->ai_addrlen);
+                item.len = ai->ai_addrlen;
+                item.family = ai->ai_family;
+                addrs.push_back(item);
+            }
+            freeaddrinfo(res);
+        }
+
+        lock_guard<mutex> lk(mtx);
+
+        if (addrs.empty()){
+            auto it = cache.find(key);
+            if (it == cache.end()){
+                return false;
+            }
+            addrs = it->second.addrs;
+            return true;
+        }
+
+        if (DnsCacheTimeout() > 0){
+            DnsCache& item = cache[key];
+            item.addrs = addrs;
+            item.etime = now + DnsCacheTimeout();
+        }
+
+        return true;
+    }
+
+    // socket连接服务器,ip可以是主机名、IPv4或IPv6地址,为unix:/path形式时使用unix域套接字(忽略port)
+	int SocketConnectTimeout(const char* ip, int port, int timeout){
+        if (IsUnixSocketPath(ip)){
+            struct sockaddr_un addr;
+            const char* path = ip + 5;
+
+            if (*path == 0 || strlen(path) >= sizeof(addr.sun_path)){
+                return INVALID_SOCKET;
+            }
+
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            strcpy(addr.sun_path, path);
+
+            return SocketConnectAddress(AF_UNIX, (struct sockaddr*)(&addr), sizeof(addr), timeout);
+        }
+
+        vector<SocketAddress> addrs;
+        int64 etime = GetMillisecond() + timeout;
+
+        if (!SocketResolve(ip, port, addrs)){
+            return INVALID_SOCKET;
+        }
+
+        // 依次尝试解析出的每个地址(IPv4与IPv6),直到连接成功或者超时
+        for (const SocketAddress& item : addrs){
+            int remain = (int)(etime - GetMillisecond());
+            if (remain <= 0){
+                break;
+            }
+            int sock = SocketConnectAddress(item.family, (struct sockaddr*)(&item.addr), item.len, remain);
+            if (!IsSocketClosed(sock)){
+                return sock;
+            }
+        }
+
         return INVALID_SOCKET;
     }
 
+    // 按照SocketOption设置socket参数,unix域套接字只设置缓冲区大小
+    static bool SocketSetOption(int sock, const SocketOption& option){
+        int val = 0;
+        bool res = true;
+        struct sockaddr_storage addr;
+        socklen_t len = sizeof(addr);
+
+        if (getsockname(sock, (struct sockaddr*)(&addr), &len) < 0){
+            return false;
+        }
+
+        if (option.sendBufSize > 0){
+            res &= setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &option.sendBufSize, sizeof(int)) == 0;
+        }
+        if (option.recvBufSize > 0){
+            res &= setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &option.recvBufSize, sizeof(int)) == 0;
+        }
+        if (addr.ss_family == AF_UNIX){
+            return res;
+        }
+
+#ifdef SO_BUSY_POLL
+        // 忙轮询需要内核支持,没有权限时失败不影响连接
+        if (option.busyPoll > 0){
+            setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &option.busyPoll, sizeof(int));
+        }
+#endif
+        val = option.noDelay ? 1 : 0;
+        res &= setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val)) == 0;
+
+        if (option.keepIdle > 0){
+            val = 1;
+            res &= setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &val, sizeof(val)) == 0;
+            res &= setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &option.keepIdle, sizeof(int)) == 0;
+            if (option.keepIntvl > 0){
+                res &= setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &option.keepIntvl, sizeof(int)) == 0;
+            }
+            if (option.keepCnt > 0){
+                res &= setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &option.keepCnt, sizeof(int)) == 0;
+            }
+        }
+
+        return res;
+    }
+
 // Redis网络连接函数
 public:
     // 关闭sock
@@ -146,6 +368,10 @@ public:
         sockFd_ = INVALID_SOCKET;
     }
 
+    SOCKET getSocket() const{
+        return sockFd_;
+    }
+
     // sock是否关闭
     bool isClosed(){
         return IsSocketClosed(sockFd_);
@@ -164,7 +390,20 @@ public:
     bool socketConnect(const string& ip, int port, int timeout){
         closeConnect();
         sockFd_ = SocketConnectTimeout(ip.c_str(), port, timeout);
-        return IsSocketClosed(sockFd_) ? false : true;
+        if(IsSocketClosed(sockFd_)){
+            return false;
+        }
+        SocketSetOption(sockFd_, sockopt);
+        return true;
+    }
+
+    // 设置socket参数,在下一次连接(或重连)时生效
+    void setSocketOption(const SocketOption& option){
+        sockopt = option;
+    }
+
+    const SocketOption& getSocketOption() const{
+        return sockopt;
     }
 
 // Redis网络连接函数
@@ -245,13 +484,381 @@ public:
         }
     }
 
+    // 发送包含count个命令的数据并接收所有回复,设置了执行器时交给执行器完成
+    template<typename FUNC>
+    int request(const string& data, int count, FUNC func, int timeout){
+        if(breaker){
+            return breakRequest(data, count, func, timeout);
+        }
+        if(executor){
+            return executor->execute(data, count, func, timeout);
+        }
+        if(discard() < 0 || write(data.c_str(), data.size()) < 0){
+            return NETERR;
+        }
+        return recvReply(count, func, timeout);
+    }
+
+    // 经过熔断器的请求:熔断打开时直接返回CIRCUITOPEN,网络错误与超时计入失败.
+    // 出错的连接上可能还有没有读完的回复,关闭后在下一次放行的请求之前重连
+    template<typename FUNC>
+    int breakRequest(const string& data, int count, FUNC func, int timeout){
+        shared_ptr<RedisBreaker> item = breaker;
+        int64 token = item->allow();
+        int res = OK;
+
+        if(token == RedisBreaker::REJECTED){
+            return CIRCUITOPEN;
+        }
+
+        // 请求期间不再经过熔断器(重连时的AUTH等)
+        breaker.reset();
+
+        if(executor){
+            res = executor->execute(data, count, func, timeout);
+        }else if(isClosed() && !reconnect()){
+            res = NETERR;
+        }else if(discard() < 0 || write(data.c_str(), data.size()) < 0){
+            res = NETERR;
+        }else{
+            res = recvReply(count, func, timeout);
+        }
+
+        if(!executor && IsNetError(res)){
+            closeConnect();
+        }
+
+        breaker = item;
+        item->record(token, !IsNetError(res));
+
+        return res;
+    }
+
+    // 是否为网络错误或超时(说明节点或连接不可用)
+    static bool IsNetError(int code){
+        return code == NETERR || code == NETCLOSE || code == IOERR || code == TIMEOUT;
+    }
+
+    // 丢弃之前放弃等待的回复(见hedge),读取失败时重新连接
+    int discard(){
+        if(skip <= 0){
+            return OK;
+        }
+
+        int num = skip;
+
+        skip = 0;
+        if(recvReply(num, [](const char*, const char*){}, timeout) < 0){
+            return reconnect() ? OK : NETERR;
+        }
+
+        return OK;
+    }
+
+    // 等待a或b可读,a可读返回1,b可读返回2,超时返回0(b可以是INVALID_SOCKET)
+    static int WaitReadable(SOCKET a, SOCKET b, int64 us){
+        struct pollfd fds[2];
+        struct timespec ts;
+
+        fds[0].fd = a;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        fds[1].fd = b;
+        fds[1].events = POLLIN;
+        fds[1].revents = 0;
+        ts.tv_sec = us / 1000000;
+        ts.tv_nsec = (us % 1000000) * 1000;
+
+        if(ppoll(fds, b == INVALID_SOCKET ? 1 : 2, &ts, NULL) <= 0){
+            return 0;
+        }
+
+        return fds[0].revents ? 1 : 2;
+    }
+
+    // 设置命令执行器(如多路复用连接),设置后当前对象不再需要自己的socket连接
+    void setExecutor(const shared_ptr<Executor>& executor, int timeout = 3000){
+        this->executor = executor;
+        this->timeout = timeout;
+    }
+
+    const shared_ptr<Executor>& getExecutor() const{
+        return executor;
+    }
+
+    // 接收count个完整的回复,每收到一个完整回复就调用func(msg, end),
+    // recv超时(SOCKET_TIMEOUT)只表示暂时没有数据,累计等待超过timeout毫秒才返回TIMEOUT
+    template<typename FUNC>
+    int recvReply(int count, FUNC func, int timeout){
+        int len = 0;
+        int pos = 0;
+        int delay = 0;
+        int readed = 0;
+        char* dest = buffer;
+
+        while(count > 0){
+            // 先处理缓冲区中已经完整的回复
+            while(count > 0 && pos < readed){
+                const char* end = NULL;
+                int res = ParseReply(dest + pos, dest + readed, end, NULL);
+                if(res == TIMEOUT){
+                    break;
+                }
+                if(res < 0){
+                    return res;
+                }
+                func((const char*)(dest + pos), end);
+                pos = end - dest;
+                --count;
+            }
+
+            if(count <= 0){
+                break;
+            }
+
+            // 把不完整的回复移动到缓冲区开头
+            if(pos > 0){
+                memmove(dest, dest + pos, readed - pos);
+                readed -= pos;
+                pos = 0;
+            }
+
+            if(readed >= memsz){
+                return PARAMERR;
+            }
+
+            if((len = read(dest + readed, memsz - readed, false)) < 0){
+                if(len != TIMEOUT){
+                    return len;
+                }
+                if((delay += SOCKET_TIMEOUT) > timeout){
+                    return TIMEOUT;
+                }
+                continue;
+            }
+
+            delay = 0;
+            dest[readed += len] = 0;
+        }
+
+        return OK;
+    }
+
+    // 查找"\r\n"的位置,只在[str, tail)范围内查找,不依赖字符串以0结尾
+    static const char* FindLineEnd(const char* str, const char* tail){
+        while(str + 1 < tail){
+            const char* pos = (const char*)memchr(str, '\r', tail - str - 1);
+            if(pos == NULL){
+                return NULL;
+            }
+            if(pos[1] == '\n'){
+                return pos;
+            }
+            str = pos + 1;
+        }
+        return NULL;
+    }
+
+    // 在缓冲区中直接解析[str, end)范围内的64位整数,不分配内存
+    static bool ParseInteger(const char* str, const char* end, int64& val){
+        bool neg = false;
+        u_int64 num = 0;
+        const u_int64 limit = 0x7FFFFFFFFFFFFFFFULL;
+
+        if(str < end && (*str == '-' || *str == '+')){
+            neg = *str++ == '-';
+        }
+        if(str >= end){
+            return false;
+        }
+        while(str < end){
+            if(*str < '0' || *str > '9'){
+                return false;
+            }
+            u_int64 digit = *str++ - '0';
+            if(num > (limit + 1 - digit) / 10){
+                return false;
+            }
+            num = num * 10 + digit;
+        }
+        if(num > limit + (neg ? 1 : 0)){
+            return false;
+        }
+        val = neg ? (int64)(0 - num) : (int64)(num);
+        return true;
+    }
+
+    // 解析[str, end)范围内的浮点数(支持inf/-inf),使用栈上缓冲区保证以0结尾
+    static bool ParseDouble(const char* str, const char* end, double& val){
+        char buf[64];
+        char* pos = NULL;
+        int len = end - str;
+
+        if(len <= 0 || len >= (int)(sizeof(buf))){
+            return false;
+        }
+        memcpy(buf, str, len);
+        buf[len] = 0;
+        val = strtod(buf, &pos);
+
+        return pos == buf + len;
+    }
+
+    // 通用的回复节点,可以表示嵌套数组(如EXEC、XREADGROUP的回复)
+    struct Reply{
+        char type = 0;        // '+' '-' ':' '$' '*'
+        bool null = false;    // 是否为nil($-1或*-1)
+        int64 integer = 0;    // 整型回复的值
+        string str;           // 字符串、错误信息
+        vector<Reply> elements;  // 数组元素
+
+        bool isNull() const{
+            return null;
+        }
+
+        bool isError() const{
+            return type == '-';
+        }
+
+        bool isArray() const{
+            return type == '*' && !null;
+        }
+
+        size_t size() const{
+            return elements.size();
+        }
+
+        const Reply& operator[](size_t idx) const{
+            return elements.at(idx);
+        }
+
+        const string& getString() const{
+            return str;
+        }
+
+        // 整型回复直接返回,字符串回复在原地解析
+        bool getInteger(int64& val) const{
+            if(type == ':'){
+                val = integer;
+                return true;
+            }
+            return !null && ParseInteger(str.c_str(), str.c_str() + str.size(), val);
+        }
+
+        bool getDouble(double& val) const{
+            if(type == ':'){
+                val = (double)(integer);
+                return true;
+            }
+            return !null && ParseDouble(str.c_str(), str.c_str() + str.size(), val);
+        }
+
+        int64 getInteger() const{
+            int64 val = 0;
+            getInteger(val);
+            return val;
+        }
+
+        double getDouble() const{
+            double val = 0;
+            getDouble(val);
+            return val;
+        }
+    };
+
+    // 解析一个完整的回复,end返回回复结束的位置,数据不完整返回TIMEOUT,
+    // reply为NULL时只检查回复是否完整,不构造任何对象
+    static int ParseReply(const char* msg, const char* tail, const char*& end, Reply* reply){
+        int64 sz = 0;
+        const char* str = msg + 1;
+
+        if(msg >= tail){
+            return TIMEOUT;
+        }
+        if((end = FindLineEnd(str, tail)) == NULL){
+            return TIMEOUT;
+        }
+        if(reply){
+            reply->type = *msg;
+        }
+
+        switch(*msg){
+            case '+':
+            case '-':
+                if(reply){
+                    reply->str.assign(str, end);
+                }
+                end += 2;
+                return OK;
+            case ':':
+                if(!ParseInteger(str, end, sz)){
+                    return DATAERR;
+                }
+                if(reply){
+                    reply->integer = sz;
+                }
+                end += 2;
+                return OK;
+            case '$':
+            case '*':
+                if(!ParseInteger(str, end, sz)){
+                    return DATAERR;
+                }
+                break;
+            default:
+                return DATAERR;
+        }
+
+        str = end + 2;
+
+        if(sz < 0){
+            if(reply){
+                reply->null = true;
+            }
+            end = str;
+            return OK;
+        }
+
+        if(*msg == '$'){
+            if(tail - str < sz + 2){
+                return TIMEOUT;
+            }
+            if(reply){
+                reply->str.assign(str, str + sz);
+            }
+            end = str + sz + 2;
+            return OK;
+        }
+
+        // 每个元素至少占3个字节,数据明显不够时不必继续解析
+        if(sz > (tail - str) / 3){
+            return TIMEOUT;
+        }
+        if(reply){
+            reply->elements.resize(sz);
+        }
+        for(int64 i = 0; i < sz; i++){
+            int res = ParseReply(str, tail, end, reply ? &reply->elements[i] : NULL);
+            if(res < 0){
+                return res;
+            }
+            str = end;
+        }
+        end = str;
+
+        return OK;
+    }
+
  	class Command{
 		friend RedisConnect;
 
 	protected:
+		int code;   // 执行结果
 		int status;   // 状态
+		int64 integer;   // 整型回复的值
 		string msg;   // 提示信息
 		vector<string> res;  // 收到的回复字段
+		vector<bool> nulls;  // res中对应的字段是否为nil
 		vector<string> vec;  // 所有的命令字段
 
 	protected:
@@ -278,38 +885,44 @@ public:
                   $5\r\n
                   world\r\n"
 			*/
+            const char* tail = msg + len;
+
+            res.clear();
+            nulls.clear();
+
             if (*msg == '$'){
-                const char* end = parseNode(msg, len);
-                if(end == NULL){
-                    return DATAERR;
+                const char* end = NULL;
+                int code = parseNode(msg, tail, end);
+                if(code < 0){
+                    return code;
                 }
-                switch (end - msg){
-                    case 0:
-                        return TIMEOUT;
-                    case 1:
-                        return NOTFOUND;
+                if(nulls.back()){
+                    res.clear();
+                    nulls.clear();
+                    return NOTFOUND;
                 }
                 return OK;
             }
 
             const char* str = msg + 1;
-            const char* end = strstr(str, "\r\n");
+            const char* end = FindLineEnd(str, tail);
 
             if(end == NULL){
                 return TIMEOUT;
             }
 
-            if(*msg == '+' || *msg == '-' || *msg == ':'){
+            if(*msg == '+' || *msg == '-'){
                 this->status = OK;
                 this->msg = string(str, end);
-                if(*msg == '+'){
-                    return OK;
-                }
-                if(*msg == '-'){
-                    return FAIL;
+                return *msg == '+' ? OK : FAIL;
+            }
+
+            // 整型直接在缓冲区中解析,不再构造msg字符串,status保留低32位以兼容原有用法
+            if(*msg == ':'){
+                if(!ParseInteger(str, end, integer)){
+                    return DATAERR;
                 }
-                // 如果是整型,如果是整型status就是数字
-                this->status = atoi(str);
+                this->status = (int)(integer);
                 return OK;
             }
             /*
@@ -320,56 +933,93 @@ public:
                   world\r\n"
             */
             if(*msg == '*'){
-                int cnt = atoi(str);
-                const char* tail = msg + len;
-                vec.clear();
-                str = end + 2;
-                while(cnt-- > 0){
-                    if(*str == '*'){
-                        return parse(str, tail - str);
-                    }
-                    end = parseNode(str, tail - str);
-
-                    if(end == NULL){
-                        return DATAERR;
-                    }
-                    if(end == str){
-                        return TIMEOUT;
-                    }
-
-                    str = end;
+                int code = parseNode(msg, tail, end);
+                if(code < 0){
+                    return code;
+                }
+                // *-1表示空数组(如BLPOP超时)
+                if(code == NOTFOUND){
+                    return NOTFOUND;
                 }
                 return res.size();
             }
+
+            return DATAERR;
         }
 
-        const char* parseNode(const char* msg, int len){
+        // 解析一个回复节点,end返回节点结束的位置,嵌套数组会被展开到res中,
+        // nil元素在res中保存为空字符串并在nulls中标记,数据不完整返回TIMEOUT
+        int parseNode(const char* msg, const char* tail, const char*& end){
+            if(msg >= tail){
+                return TIMEOUT;
+            }
+
+            int64 sz = 0;
             const char* str = msg + 1;
-            // 返回str种第一次出现"\r\n"的位置,如果不存在就直接返回msg
-            const char* end = strstr(str, "\r\n");
-            if(end == NULL){
-                return msg;
+
+            // 返回str中第一次出现"\r\n"的位置
+            if((end = FindLineEnd(str, tail)) == NULL){
+                return TIMEOUT;
             }
-            // "$5\r\nhello\r\n"  sz = 5
-            int sz = atoi(str);
-            if(sz < 0){
-                return msg + sz;
+
+            switch(*msg){
+                case '+':
+                case '-':
+                case ':':
+                    res.push_back(string(str, end));
+                    nulls.push_back(false);
+                    end += 2;
+                    return OK;
+                case '$':
+                case '*':
+                    if(!ParseInteger(str, end, sz)){
+                        return DATAERR;
+                    }
+                    break;
+                default:
+                    return DATAERR;
             }
+
             // 跳过\r\n
             str = end + 2;
-            end = str + sz + 2;
-            if(msg + len < end){
-                return msg;
-            }
-            res.push_back(string(str, str + sz));
-            return end;
-        }
-
-	public:
-		Command(): status(0){}
-        Command(const string& cmd): status(0){
-            vec.push_back(cmd);
-        }
+
+            if(*msg == '*'){
+                if(sz < 0){
+                    end = str;
+                    return NOTFOUND;
+                }
+                while(sz-- > 0){
+                    int code = parseNode(str, tail, end);
+                    if(code < 0 && code != NOTFOUND){
+                        return code;
+                    }
+                    str = end;
+                }
+                end = str;
+                return OK;
+            }
+
+            // "$5\r\nhello\r\n"  sz = 5, $-1表示nil
+            if(sz < 0){
+                res.push_back(string());
+                nulls.push_back(true);
+                end = str;
+                return OK;
+            }
+            if(tail - str < sz + 2){
+                return TIMEOUT;
+            }
+            res.push_back(string(str, str + sz));
+            nulls.push_back(false);
+            end = str + sz + 2;
+            return OK;
+        }
+
+	public:
+		Command(): code(0), status(0), integer(0){}
+        Command(const string& cmd): code(0), status(0), integer(0){
+            vec.push_back(cmd);
+        }
 
         void add(const char* val){
             vec.push_back(val);
@@ -379,6 +1029,17 @@ public:
             vec.push_back(val);
         }
         
+        // 浮点数按%.17g格式化,保证精度不丢失(to_string只保留6位小数)
+        void add(double val){
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%.17g", val);
+            vec.push_back(buf);
+        }
+
+        void add(float val){
+            add((double)(val));
+        }
+
         template<typename T>
         void add(T val){
             add(to_string(val));
@@ -408,6 +1069,21 @@ public:
             return out;
         }
 
+		// 获取命令字段
+        const vector<string>& getCommand() const{
+            return vec;
+        }
+
+		// 获取执行结果(与execute的返回值相同)
+        int getCode() const{
+            return code;
+        }
+
+		// 获取错误信息
+        const string& getErrorString() const{
+            return msg;
+        }
+
 		// 获取指定索引的结果
         string get(int idx) const{
             return res.at(idx);
@@ -418,47 +1094,102 @@ public:
             return res;
         }
 
+        // 获取整型回复的值
+        int64 getInteger() const{
+            return integer;
+        }
+
+        // 指定索引的结果是否为nil
+        bool isNull(int idx) const{
+            return nulls.at(idx);
+        }
+
+        // 获取指定索引的字符串结果,结果为nil时返回false
+        bool getString(int idx, string& val) const{
+            if(idx < 0 || idx >= (int)(res.size()) || nulls[idx]){
+                return false;
+            }
+            val = res[idx];
+            return true;
+        }
+
+        // 将指定索引的结果解析为整数
+        bool getInteger(int idx, int64& val) const{
+            if(idx < 0 || idx >= (int)(res.size()) || nulls[idx]){
+                return false;
+            }
+            return ParseInteger(res[idx].c_str(), res[idx].c_str() + res[idx].size(), val);
+        }
+
+        // 将指定索引的结果解析为浮点数
+        bool getDouble(int idx, double& val) const{
+            if(idx < 0 || idx >= (int)(res.size()) || nulls[idx]){
+                return false;
+            }
+            return ParseDouble(res[idx].c_str(), res[idx].c_str() + res[idx].size(), val);
+        }
+
 		int getResult(RedisConnect* redis, int timeout)
 		{
 			// 发送消息，再接收消息
 			auto doWork = [&](){
                 string msg = toString();
                 // cout << msg << endl;
-                if(redis->write(msg.c_str(), msg.size()) < 0){
-                    return NETERR;
-                }
+                int res = OK;
+                int len = redis->request(msg, 1, [&](const char* data, const char* end){
+                    res = parse(data, end - data);
+                }, timeout);
 
-                int len = 0;
-                int delay = 0;
-                int readed = 0;
-                char* dest = redis->buffer;
-                const int maxsz = redis->memsz;
-
-                while(readed < maxsz){
-                    if((len = redis->read(dest + readed, maxsz - readed, false)) < 0){
-                        return len;
-                    }else if(len == 0){
-                        delay += SOCKET_TIMEOUT;
-                        if(delay > timeout){
-                            return TIMEOUT;
-                        }
-                    }else{
-                        dest[readed += len] = 0;
-                        // 每次都是把目前已经读到的数据和长度都放进去解析
-                        if((len = parse(dest, readed)) == TIMEOUT){
-                            delay = 0;
-                        }else{
-                            return len;
-                        }
-                    }
-                }
-                return PARAMERR;
+                return len < 0 ? len : res;
             };
 
+			reset();
+
+            if(redis->hotkey){
+                redis->hotkey->track(vec);
+            }
+
+            if(!redis->negcache){
+                return setResult(redis, doWork());
+            }
+
+            // 缓存了未命中结果时不再访问redis,写命令执行后使涉及的键失效
+            u_int32 version = 0;
+            bool cacheable = RedisNegCache::IsCacheable(vec);
+
+            if(cacheable){
+                if(redis->negcache->lookup(vec, version)){
+                    res.clear();
+                    nulls.clear();
+                    return setResult(redis, NOTFOUND);
+                }
+                if(version && !redis->syncTracking()){
+                    version = 0;
+                }
+            }
+
+            int code = doWork();
+
+            if(!cacheable){
+                redis->negcache->invalidate(vec);
+            }else if(version && code == NOTFOUND){
+                redis->negcache->insert(vec, version);
+            }
+
+            return setResult(redis, code);
+		}
+
+	protected:
+		void reset(){
 			status = 0;
-            msg.clear();
-            redis->code = doWork();
-            
+			integer = 0;
+			msg.clear();
+		}
+
+		// 保存执行结果并同步到连接上
+		int setResult(RedisConnect* redis, int code){
+            redis->code = this->code = code;
+
             if(redis->code < 0 && msg.empty()){
                 switch (redis->code)
 				{
@@ -477,16 +1208,139 @@ public:
 				case NOTFOUND:
 					msg = "element not found";
 					break;
+				case ABORTED:
+					msg = "transaction aborted";
+					break;
+				case CIRCUITOPEN:
+					msg = "circuit breaker open";
+					break;
 				default:
 					msg = "unknown error";
 					break;
 				}
             }
             redis->status = status;
+            redis->integer = integer;
             redis->msg = msg;
             return redis->code;
 		}
-	};   
+	};
+
+	// 事务:命令先缓存在客户端,exec时把MULTI、所有命令与EXEC一次写入,
+	// EXEC返回的数组解析为每个命令对应的Reply.配合watch实现乐观锁,
+	// 被监视的键在exec之前被修改时exec返回ABORTED
+	class Transaction{
+	protected:
+		RedisConnect* redis;
+		vector<Command> cmds;  // 缓存的命令
+		vector<Reply> results;  // 每个命令的执行结果
+
+		int setResult(int code, const string& msg){
+			redis->code = code;
+			redis->status = 0;
+			redis->integer = 0;
+			redis->msg = msg;
+			return code;
+		}
+
+	public:
+		Transaction(RedisConnect* redis): redis(redis){}
+
+		// 监视键值,需要在读取这些键之前调用(立即发送WATCH)
+		template<typename ...ARGS>
+		int watch(const string& key, ARGS ...args){
+			return redis->execute("watch", key, args...);
+		}
+
+		int unwatch(){
+			return redis->execute("unwatch");
+		}
+
+		void add(const Command& cmd){
+			cmds.push_back(cmd);
+		}
+
+		template<typename T, typename ...ARGS>
+		void add(T val, ARGS ...args){
+			Command cmd;
+			cmd.add(val, args...);
+			cmds.push_back(cmd);
+		}
+
+		int size() const{
+			return cmds.size();
+		}
+
+		// 放弃缓存的命令并取消监视
+		int discard(){
+			cmds.clear();
+			results.clear();
+			return unwatch();
+		}
+
+		// 提交事务,成功返回OK,结果通过getResults获取
+		int exec(){
+			int idx = 0;
+			int res = OK;
+			string err;
+			Reply reply;
+			const int count = cmds.size();
+			string data = Command("multi").toString();
+
+			for(const Command& cmd : cmds){
+				data += cmd.toString();
+				if(redis->hotkey){
+					redis->hotkey->track(cmd.vec);
+				}
+			}
+			data += Command("exec").toString();
+
+			vector<Command> queued;
+
+			queued.swap(cmds);
+			results.clear();
+
+			// 依次收到MULTI的+OK、每个命令的+QUEUED以及EXEC的回复
+			int len = redis->request(data, count + 2, [&](const char* msg, const char* end){
+				if(idx++ <= count){
+					if(*msg == '-' && err.empty()){
+						err.assign(msg + 1, end - 2);
+					}
+					return;
+				}
+				ParseReply(msg, end, end, &reply);
+			}, redis->timeout);
+
+			if(redis->negcache){
+				for(const Command& cmd : queued){
+					redis->negcache->invalidate(cmd.vec);
+				}
+			}
+
+			if(len < 0){
+				return setResult(len, len == TIMEOUT ? "response timeout" : "network error");
+			}
+			if(reply.isError()){
+				return setResult(FAIL, err.empty() ? reply.str : err);
+			}
+			if(reply.isNull()){
+				return setResult(ABORTED, "transaction aborted");
+			}
+
+			swap(results, reply.elements);
+
+			return setResult(res, "");
+		}
+
+		// 获取每个命令的执行结果
+		const vector<Reply>& getResults() const{
+			return results;
+		}
+
+		const Reply& getResult(int idx) const{
+			return results.at(idx);
+		}
+	};
 
 public:
     ~RedisConnect(){
@@ -501,10 +1355,15 @@ public:
 	int getStatus() const{
 		return status;
 	}
+
+	// 获取整型回复的值(64位,status只有低32位)
+	int64 getInteger() const{
+		return integer;
+	}
     
     // 返回错误码，redis连接的错误,无错误返回0
     int getErrorCode(){
-        if(isClosed()){
+        if(isClosed() && !executor){
             return FAIL;
         }
         return code < 0 ? code : 0;
@@ -517,30 +1376,301 @@ public:
 
 public:
     bool reconnect(){
-        if(host.empty()){
+        // 熔断打开时不再等待连接超时
+        if(host.empty() || (breaker && breaker->isOpen())){
             return false;
         }
         return connectRedis(host, port, timeout, memsz) && auth(passwd) > 0;
     }
 
+    // host可以是ip地址,也可以是unix:/path/to/redis.sock形式的unix域套接字地址
     bool connectRedis(const string& host, int port, int timeout = 3000, int memsz = 2 * 1024 * 1024){
         closeConnect();
-        if(socketConnect(host, port, timeout)){
-            setSendTimeout(SOCKET_TIMEOUT);
-            setRecvTimeout(SOCKET_TIMEOUT);
-            this->host = host;
-            this->port = port;
-            this->memsz = memsz;
-            this->timeout = timeout;
-            this->buffer = new char[memsz + 1];
+        if(!socketConnect(host, port, timeout)){
+            return false;
+        }
+        setSendTimeout(SOCKET_TIMEOUT);
+        setRecvTimeout(SOCKET_TIMEOUT);
+        // 重连时复用已有的缓冲区
+        if(buffer && this->memsz != memsz){
+            delete[] buffer;
+            buffer = NULL;
         }
-        return buffer ? true : false;
+        this->host = host;
+        this->port = port;
+        this->memsz = memsz;
+        this->timeout = timeout;
+        // 新的连接需要重新开启CLIENT TRACKING
+        this->tracking = 0;
+        if(buffer == NULL){
+            buffer = new char[memsz + 1];
+        }
+        return true;
     }
 
     int execute(Command& cmd){
         return cmd.getResult(this, timeout);
     }
 
+    // 批量执行命令:所有命令一次写入,再依次接收回复,每个命令的结果保存在对应的Command中,
+    // 返回OK表示所有回复都已收到(单个命令是否成功看Command::getCode),否则返回网络错误码
+    int pipeline(vector<Command>& cmds){
+        return pipeline(cmds.data(), cmds.size(), NULL, timeout);
+    }
+
+    // 批量执行命令并把每个回复解析为Reply(用于嵌套数组),timeout为0时使用连接的超时时间
+    int pipeline(vector<Command>& cmds, vector<Reply>& replies, int timeout = 0){
+        replies.clear();
+        replies.resize(cmds.size());
+        return pipeline(cmds.data(), cmds.size(), replies.data(), timeout > 0 ? timeout : this->timeout);
+    }
+
+    // 对冲读:在当前连接上发送cmd,delay微秒内没有收到回复时调用backup获取另一个连接(返回NULL表示不对冲)
+    // 再发送一次,采用先到达的回复,winner返回回复来自的连接.未被采用的连接上还有一个回复,
+    // 会在该连接下一次请求前丢弃,因此只能用于只读且幂等的命令.
+    // 与execute一样经过未命中缓存与熔断器:熔断打开时返回CIRCUITOPEN,结果计入胜出连接的熔断器,
+    // 熔断探测请求与熔断没有关闭的备用连接不对冲;两次等待与接收回复共用timeout
+    int hedge(Command& cmd, int64 delay, const function<RedisConnect*()>& backup, RedisConnect** winner = NULL){
+        RedisConnect* conn = this;
+        RedisConnect* other = NULL;
+        int64 token = RedisBreaker::NORMAL;
+        int64 otherToken = RedisBreaker::NORMAL;
+        u_int32 version = 0;
+        bool cacheable = false;
+        int res = OK;
+        int len = OK;
+
+        if(winner){
+            *winner = this;
+        }
+        if(executor){
+            return execute(cmd);
+        }
+
+        string data = cmd.toString();
+
+        cmd.reset();
+        if(hotkey){
+            hotkey->track(cmd.vec);
+        }
+
+        // 缓存了未命中结果时不再访问redis
+        if(negcache && (cacheable = RedisNegCache::IsCacheable(cmd.vec))){
+            if(negcache->lookup(cmd.vec, version)){
+                cmd.res.clear();
+                cmd.nulls.clear();
+                return cmd.setResult(this, NOTFOUND);
+            }
+            if(version && !syncTracking()){
+                version = 0;
+            }
+        }
+
+        if(breaker && (token = breaker->allow()) == RedisBreaker::REJECTED){
+            return cmd.setResult(this, CIRCUITOPEN);
+        }
+
+        int64 deadline = GetMillisecond() + timeout;
+        auto remain = [&](){
+            return max(deadline - GetMillisecond(), (int64)(1));
+        };
+
+        if((breaker && isClosed() && !reconnect()) || discard() < 0 || write(data.c_str(), data.size()) < 0){
+            len = NETERR;
+        }else{
+            if(token == RedisBreaker::NORMAL && WaitReadable(sockFd_, INVALID_SOCKET, delay) == 0){
+                other = backup();
+            }
+            if(other && (other->executor || (other->breaker && (other->breaker->getState() != RedisBreaker::CLOSED
+                || (otherToken = other->breaker->allow()) == RedisBreaker::REJECTED)))){
+                other = NULL;
+            }
+            if(other){
+                if((other->breaker && other->isClosed() && !other->reconnect())
+                    || other->discard() < 0 || other->write(data.c_str(), data.size()) < 0){
+                    if(other->breaker){
+                        other->closeConnect();
+                        other->breaker->record(otherToken, false);
+                    }
+                // 两个连接中先收到数据的一个胜出,另一个的回复留待丢弃
+                }else if(WaitReadable(sockFd_, other->sockFd_, remain() * 1000) == 2){
+                    conn = other;
+                    ++skip;
+                }else{
+                    ++other->skip;
+                }
+            }
+            len = conn->recvReply(1, [&](const char* msg, const char* end){
+                res = cmd.parse(msg, end - msg);
+            }, remain());
+        }
+
+        int code = len < 0 ? len : res;
+
+        // 只有胜出的连接知道结果,落后连接的普通请求不需要记录
+        if(conn->breaker){
+            if(IsNetError(code)){
+                conn->closeConnect();
+            }
+            conn->breaker->record(conn == this ? token : otherToken, !IsNetError(code));
+        }
+
+        // 只缓存当前连接(开启了服务端失效通知)读到的未命中
+        if(cacheable && version && code == NOTFOUND && conn == this){
+            negcache->insert(cmd.vec, version);
+        }
+
+        if(winner){
+            *winner = conn;
+        }
+
+        return cmd.setResult(conn, code);
+    }
+
+    // 单向发送不需要回复的写命令:在命令前加上CLIENT REPLY SKIP,服务端不回复紧随其后的命令,
+    // 数据交给内核后立即返回OK,不等待往返.命令本身执行失败(如WRONGTYPE)时也不会得到错误,
+    // 只能用于不关心结果的写入;设置了执行器(多路复用连接)时按execute执行
+    int post(Command& cmd){
+        return post(&cmd, 1);
+    }
+
+    int post(vector<Command>& cmds){
+        return post(cmds.data(), cmds.size());
+    }
+
+    int post(Command* cmds, int count){
+        static const string skip = "*3\r\n$6\r\nclient\r\n$5\r\nreply\r\n$4\r\nskip\r\n";
+
+        if(executor){
+            return pipeline(cmds, count, NULL, timeout);
+        }
+
+        string data;
+
+        for(int i = 0; i < count; i++){
+            data += skip + cmds[i].toString();
+            if(hotkey){
+                hotkey->track(cmds[i].vec);
+            }
+            cmds[i].reset();
+        }
+
+        int res = discard() < 0 || write(data.c_str(), data.size()) < 0 ? NETERR : OK;
+
+        if(negcache){
+            for(int i = 0; i < count; i++){
+                negcache->invalidate(cmds[i].vec);
+            }
+        }
+        for(int i = 0; i < count; i++){
+            cmds[i].code = res;
+        }
+
+        return code = res;
+    }
+
+    // 执行单个命令并把回复解析为Reply
+    int execute(Command& cmd, Reply& reply, int timeout = 0){
+        reply = Reply();
+        if(pipeline(&cmd, 1, &reply, timeout > 0 ? timeout : this->timeout) < 0){
+            return code;
+        }
+        msg = cmd.msg;
+        return code = cmd.code;
+    }
+
+    int pipeline(Command* cmds, int count, Reply* replies, int timeout){
+        string data;
+        int idx = 0;
+
+        if(count <= 0){
+            return code = OK;
+        }
+        for(int i = 0; i < count; i++){
+            data += cmds[i].toString();
+            if(hotkey){
+                hotkey->track(cmds[i].vec);
+            }
+            cmds[i].reset();
+            cmds[i].code = NETERR;
+        }
+        code = request(data, count, [&](const char* msg, const char* end){
+            Command& cmd = cmds[idx];
+            if(replies == NULL){
+                cmd.code = cmd.parse(msg, end - msg);
+            }else{
+                Reply& reply = replies[idx];
+                ParseReply(msg, end, end, &reply);
+                if(reply.isError()){
+                    cmd.msg = reply.str;
+                    cmd.code = FAIL;
+                }else{
+                    cmd.code = reply.isNull() ? NOTFOUND : OK;
+                }
+            }
+            ++idx;
+        }, timeout);
+
+        // 写命令执行后使未命中缓存中的键失效(只读命令会被忽略)
+        if(negcache){
+            for(int i = 0; i < count; i++){
+                negcache->invalidate(cmds[i].vec);
+            }
+        }
+
+        return code;
+    }
+
+    // 分两步执行pipeline:sendPipeline只写入命令,返回OK后需要用同一组命令调用recvPipeline接收回复.
+    // 用于先在多个连接上发送、再依次接收,使各连接的往返时间重叠.设置了熔断器或执行器时命令在recvPipeline中按pipeline执行
+    int sendPipeline(Command* cmds, int count){
+        string data;
+
+        if(count <= 0 || breaker || executor){
+            return code = OK;
+        }
+        for(int i = 0; i < count; i++){
+            data += cmds[i].toString();
+            if(hotkey){
+                hotkey->track(cmds[i].vec);
+            }
+            cmds[i].reset();
+            cmds[i].code = NETERR;
+        }
+        if(discard() < 0 || write(data.c_str(), data.size()) < 0){
+            return code = NETERR;
+        }
+
+        return code = OK;
+    }
+
+    // 接收sendPipeline发送的命令的回复,timeout为0时使用连接的超时时间
+    int recvPipeline(Command* cmds, int count, int timeout = 0){
+        int idx = 0;
+
+        if(timeout <= 0){
+            timeout = this->timeout;
+        }
+        if(count <= 0){
+            return code = OK;
+        }
+        if(breaker || executor){
+            return pipeline(cmds, count, NULL, timeout);
+        }
+        code = recvReply(count, [&](const char* msg, const char* end){
+            Command& cmd = cmds[idx++];
+            cmd.code = cmd.parse(msg, end - msg);
+        }, timeout);
+
+        if(negcache){
+            for(int i = 0; i < count; i++){
+                negcache->invalidate(cmds[i].vec);
+            }
+        }
+
+        return code;
+    }
+
 	//调用成功返回值不小于零(你可以马上调用getStatus方法获取redis返回结果)
 	template<typename T, typename ...ARGS>
     int execute(T val, ARGS ...args){
@@ -572,12 +1702,16 @@ public:
         return execute("del", key);
     }
 
-    int ttl(const string& key){
-        return execute("ttl", key) == OK ? status : code;
-    }    
+    int64 ttl(const string& key){
+        return execute("ttl", key) == OK ? integer : code;
+    }
+
+    int64 pttl(const string& key){
+        return execute("pttl", key) == OK ? integer : code;
+    }
 
-    int hlen(const string& key){
-        return execute("hlen", key) == OK ? status : code;
+    int64 hlen(const string& key){
+        return execute("hlen", key) == OK ? integer : code;
     }
 
     int auth(const string& passwd){
@@ -595,17 +1729,55 @@ public:
         }
 
         val = vec[0];
-        return code;
+        return decode(val);
     }
 
-    int decr(const string& key, int val = 1){
+    int decr(const string& key, int64 val = 1){
 		return execute("decrby", key, val);
 	}
 
-	int incr(const string& key, int val = 1){
+	int incr(const string& key, int64 val = 1){
 		return execute("incrby", key, val);
 	}
 
+	// 以下方法直接返回类型化的结果,失败时返回0,可以调用getErrorCode获取错误码
+	int64 incrby(const string& key, int64 val){
+		return execute("incrby", key, val) == OK ? integer : 0;
+	}
+
+	int64 decrby(const string& key, int64 val){
+		return execute("decrby", key, val) == OK ? integer : 0;
+	}
+
+	int64 hincrby(const string& key, const string& filed, int64 val){
+		return execute("hincrby", key, filed, val) == OK ? integer : 0;
+	}
+
+	double incrbyfloat(const string& key, double val){
+		Command cmd("incrbyfloat");
+		double res = 0;
+
+		cmd.add(key, val);
+
+		if (execute(cmd) == OK) {
+			cmd.getDouble(0, res);
+		}
+
+		return res;
+	}
+
+	bool exists(const string& key){
+		return execute("exists", key) == OK && integer > 0;
+	}
+
+	int64 llen(const string& key){
+		return execute("llen", key) == OK ? integer : 0;
+	}
+
+	int64 zcard(const string& key){
+		return execute("zcard", key) == OK ? integer : 0;
+	}
+
 	int expire(const string& key, int timeout){
 		return execute("expire", key, timeout);
 	}
@@ -627,39 +1799,116 @@ public:
         }    
 
         val = vec[0];
-        return code;
+        return decode(val);
     }
 
     int set(const string& key, const string& val, int timeout = 0){
-		return timeout > 0 ? execute("setex", key, timeout, val) : execute("set", key, val);
+		const string& data = codec ? codec->encode(val) : val;
+
+		return timeout > 0 ? execute("setex", key, timeout, data) : execute("set", key, data);
 	}
 
     int hset(const string& key, const string& filed, const string& val){
-		return execute("hset", key, filed, val);
+		return execute("hset", key, filed, codec ? codec->encode(val) : val);
 	}
 
-public:
-    int pop(const string& key, string& val){
-		return lpop(key, val);
+	// 开启值压缩:set/hset写入的值达到threshold字节时压缩后再发送,get/hget自动识别并解压,
+	// threshold小于等于0时关闭压缩(已压缩的值仍需要开启压缩的连接读取)
+	void setCompress(int threshold){
+		if (threshold <= 0) {
+			codec.reset();
+		} else {
+			codec = make_shared<RedisCodec>(threshold);
+		}
 	}
 
-	int lpop(const string& key, string& val){
-		vector<string> vec;
+	// 使用共享的值压缩编码(如连接池的所有连接共用一个),codec为空时关闭压缩
+	void setCodec(const shared_ptr<RedisCodec>& codec){
+		this->codec = codec;
+	}
 
-		if (execute(vec, "lpop", key) <= 0) {
-            return code;
-        }
+	const shared_ptr<RedisCodec>& getCodec() const{
+		return codec;
+	}
 
-		val = vec[0];
+	// 开启热点键统计:执行的命令按采样率计入hotkey,多个连接可以共享同一个RedisHotKey,
+	// 传入空指针时关闭
+	void setHotKey(const shared_ptr<RedisHotKey>& hotkey){
+		this->hotkey = hotkey;
+	}
 
-		return code;
+	const shared_ptr<RedisHotKey>& getHotKey() const{
+		return hotkey;
 	}
 
-	int rpop(const string& key, string& val){
-		vector<string> vec;
+	// 开启未命中缓存:GET/HGET返回nil的结果在缓存时间内直接返回NOTFOUND,多个连接可以共享同一个RedisNegCache,
+	// 传入空指针时关闭.需要感知其它客户端的修改时使用RedisConnPool::SetNegCache开启服务端失效通知
+	void setNegCache(const shared_ptr<RedisNegCache>& negcache){
+		this->negcache = negcache;
+	}
 
-		if (execute(vec, "rpop", key) <= 0) {
-            return code;
+	const shared_ptr<RedisNegCache>& getNegCache() const{
+		return negcache;
+	}
+
+	// 开启熔断:连接同一个节点的多个连接应当共享同一个RedisBreaker,传入空指针时关闭.
+	// 开启后出错的连接会在下一次请求前自动重连
+	void setBreaker(const shared_ptr<RedisBreaker>& breaker){
+		this->breaker = breaker;
+	}
+
+	const shared_ptr<RedisBreaker>& getBreaker() const{
+		return breaker;
+	}
+
+	// 未命中缓存开启了服务端失效通知时,确保当前连接的CLIENT TRACKING重定向到最新的订阅连接,
+	// 返回false表示当前连接读到的未命中不能缓存(如连接不在订阅连接所在的节点上)
+	bool syncTracking(){
+		int64 id = negcache ? negcache->getTrackingId(host, port) : 0;
+
+		if(id <= 0 || id == tracking){
+			return id == 0 || id == tracking;
+		}
+
+		Command cmd("client");
+
+		cmd.add("tracking", "on", "redirect", id);
+
+		if(execute(cmd) < 0){
+			return false;
+		}
+
+		tracking = id;
+
+		return true;
+	}
+
+	// 获取压缩统计(压缩率、耗时等)
+	static const RedisCodec::Stat& GetCompressStat(){
+		return RedisCodec::GetStat();
+	}
+
+protected:
+	// 开启压缩时解压读取到的值
+	int decode(string& val){
+		if (codec && !codec->decode(val)) {
+			msg = "decompress failed";
+			code = DATAERR;
+		}
+
+		return code;
+	}
+
+public:
+    int pop(const string& key, string& val){
+		return lpop(key, val);
+	}
+
+	int lpop(const string& key, string& val){
+		vector<string> vec;
+
+		if (execute(vec, "lpop", key) <= 0) {
+            return code;
         }
 
 		val = vec[0];
@@ -667,14 +1916,163 @@ public:
 		return code;
 	}
 
-	int lpush(const string& key, const string& val){
-		return execute("lpush", key, val);
+	int rpop(const string& key, string& val){
+		vector<string> vec;
+
+		if (execute(vec, "rpop", key) <= 0) {
+            return code;
+        }
+
+		val = vec[0];
+
+		return code;
 	}
 
-	int rpush(const string& key, const string& val){
-		return execute("rpush", key, val);
+	// 一次弹出最多count个元素(Redis 6.2以上支持)
+	int lpop(const string& key, int count, vector<string>& vec){
+		return execute(vec, "lpop", key, count);
 	}
 
+	int rpop(const string& key, int count, vector<string>& vec){
+		return execute(vec, "rpop", key, count);
+	}
+
+	// 可以一次写入多个元素,如lpush(key, "a", "b", "c"),新的列表长度通过getInteger获取
+	template<typename ...ARGS>
+	int lpush(const string& key, const string& val, ARGS ...args){
+		return execute("lpush", key, val, args...);
+	}
+
+	template<typename ...ARGS>
+	int rpush(const string& key, const string& val, ARGS ...args){
+		return execute("rpush", key, val, args...);
+	}
+
+	int lpush(const string& key, const vector<string>& vals){
+		return push("lpush", key, vals);
+	}
+
+	int rpush(const string& key, const vector<string>& vals){
+		return push("rpush", key, vals);
+	}
+
+	// 阻塞弹出,wait为最长等待秒数(0表示一直等待),超时返回NOTFOUND,key返回数据所在的列表
+	int blpop(const vector<string>& keys, int wait, string& key, string& val){
+		return bpop("blpop", keys, wait, key, val);
+	}
+
+	int brpop(const vector<string>& keys, int wait, string& key, string& val){
+		return bpop("brpop", keys, wait, key, val);
+	}
+
+	// 阻塞地把src的元素移动到dst(from/to为left或right),超时返回NOTFOUND
+	int blmove(const string& src, const string& dst, const string& from, const string& to, int wait, string& val){
+		Command cmd("blmove");
+
+		cmd.add(src, dst, from, to, wait);
+
+		if (cmd.getResult(this, getBlockTimeout(wait)) > 0) {
+			val = cmd.get(0);
+		}
+
+		return code;
+	}
+
+	// 队列消费循环:在当前连接上(需要专用连接)用BLPOP等待数据,取到后再用LPOP COUNT
+	// 取出同一批的剩余元素,整批交给func处理;等待wait秒仍无数据时以空数组调用func,
+	// func返回false时退出.backup不为空时改用BLMOVE/LMOVE把元素转移到backup列表,
+	// func处理成功后再从backup中删除,进程崩溃时未处理完的元素保留在backup中.
+	// 网络异常时自动重连,返回退出前最后一次的结果
+	int consume(const string& key, int batch, function<bool(vector<string>&)> func, int wait = 1, const string& backup = ""){
+		vector<string> vec;
+
+		batch = max(batch, 1);
+
+		while (true) {
+			vec.clear();
+
+			if (backup.empty()) {
+				string name;
+				string val;
+
+				if (blpop(vector<string>(1, key), wait, name, val) > 0) {
+					vec.push_back(val);
+
+					if (batch > 1 && lpop(key, batch - 1, vec) > 0) {
+						vec.insert(vec.begin(), val);
+					}
+				}
+			} else {
+				string val;
+
+				if (blmove(key, backup, "left", "right", wait, val) > 0) {
+					vector<Command> cmds(batch - 1, Command("lmove"));
+
+					for (Command& cmd : cmds) cmd.add(key, backup, "left", "right");
+
+					vec.push_back(val);
+
+					if (cmds.size() > 0 && pipeline(cmds) > 0) {
+						for (Command& cmd : cmds) {
+							if (cmd.getCode() <= 0) break;
+							vec.push_back(cmd.get(0));
+						}
+					}
+				}
+			}
+
+			if (code < 0 && code != NOTFOUND) {
+				Sleep(100);
+				reconnect();
+				continue;
+			}
+
+			if (!func(vec)) break;
+
+			if (backup.size() > 0 && vec.size() > 0) {
+				vector<Command> cmds(vec.size(), Command("lrem"));
+
+				for (size_t i = 0; i < vec.size(); i++) cmds[i].add(backup, 1, vec[i]);
+
+				pipeline(cmds);
+			}
+		}
+
+		return code;
+	}
+
+protected:
+	int push(const char* name, const string& key, const vector<string>& vals){
+		Command cmd(name);
+
+		cmd.add(key);
+
+		for (const string& val : vals) cmd.add(val);
+
+		return execute(cmd);
+	}
+
+	int bpop(const char* name, const vector<string>& keys, int wait, string& key, string& val){
+		Command cmd(name);
+
+		for (const string& item : keys) cmd.add(item);
+
+		cmd.add(wait);
+
+		if (cmd.getResult(this, getBlockTimeout(wait)) > 0) {
+			key = cmd.get(0);
+			val = cmd.get(1);
+		}
+
+		return code;
+	}
+
+	// 阻塞命令的接收超时时间需要加上服务端的等待时间
+	int getBlockTimeout(int wait) const{
+		return wait > 0 ? wait * 1000 + timeout : 0x7FFFFFFF;
+	}
+
+public:
 	int lrange(vector<string>& vec, const string& key, int start, int end){
 		return execute(vec, "lrange", key, start, end);
 	}
@@ -684,14 +2082,656 @@ public:
 		return execute("zrem", key, filed);
 	}
 
-	int zadd(const string& key, const string& filed, int score){
+	int zadd(const string& key, const string& filed, double score){
 		return execute("zadd", key, score, filed);
 	}
 
+	// 获取成员的分数,成员不存在时返回NOTFOUND
+	int zscore(const string& key, const string& filed, double& score){
+		Command cmd("zscore");
+
+		cmd.add(key, filed);
+
+		if (execute(cmd) == OK && !cmd.getDouble(0, score)) {
+			code = DATAERR;
+		}
+
+		return code;
+	}
+
 	int zrange(vector<string>& vec, const string& key, int start, int end, bool withscore = false){
 		return withscore ? execute(vec, "zrange", key, start, end, "withscores") : execute(vec, "zrange", key, start, end);
 	}
 
+    // ZADD的选项,可以组合使用(NX与XX、GT与LT互斥)
+    static const int ZADD_NX = 1;   // 只添加新成员
+    static const int ZADD_XX = 2;   // 只更新已有的成员
+    static const int ZADD_GT = 4;   // 新分数大于原分数时才更新
+    static const int ZADD_LT = 8;   // 新分数小于原分数时才更新
+    static const int ZADD_CH = 16;  // 返回新增与分数被修改的成员数(默认只返回新增的成员数)
+
+    // 批量添加(成员, 分数),每batch个成员一条ZADD命令,所有命令通过一次pipeline发送,
+    // 成功时getStatus()返回新增(指定ZADD_CH时为新增与修改)的成员总数
+    int zadd(const string& key, const vector<pair<string, double>>& members, int flags = 0, int batch = 1000){
+        vector<Command> cmds;
+        int64 total = 0;
+
+        batch = max(batch, 1);
+
+        for (size_t i = 0; i < members.size(); i += batch) {
+            cmds.push_back(Command("zadd"));
+
+            Command& cmd = cmds.back();
+
+            cmd.add(key);
+
+            if (flags & ZADD_NX) cmd.add("nx");
+            if (flags & ZADD_XX) cmd.add("xx");
+            if (flags & ZADD_GT) cmd.add("gt");
+            if (flags & ZADD_LT) cmd.add("lt");
+            if (flags & ZADD_CH) cmd.add("ch");
+
+            for (size_t j = i; j < members.size() && j < i + batch; j++) cmd.add(members[j].second, members[j].first);
+        }
+
+        if (pipeline(cmds) < 0) return code;
+
+        for (Command& cmd : cmds) {
+            if (cmd.getCode() < 0) {
+                msg = cmd.getErrorString();
+                return code = cmd.getCode();
+            }
+            total += cmd.getInteger();
+        }
+
+        integer = total;
+        status = (int)(total);
+
+        return code = OK;
+    }
+
+    // 按分数范围获取(成员, 分数),即ZRANGEBYSCORE key min max WITHSCORES LIMIT offset count(rev为true时使用ZREVRANGEBYSCORE),
+    // min与max可以是"-inf"、"(1.5"等形式.回复直接在接收缓冲区中解析到vec,vec中已有的字符串会被复用,
+    // 分数在栈上解析,重复使用同一个vec分页读取时不再分配内存.成功时getStatus()返回结果个数
+    int zrangeByScore(const string& key, const string& min, const string& max, int64 offset, int64 count, vector<pair<string, double>>& vec, bool rev = false){
+        Command cmd(rev ? "zrevrangebyscore" : "zrangebyscore");
+        int res = OK;
+
+        cmd.add(key);
+
+        if (rev) {
+            cmd.add(max, min);
+        } else {
+            cmd.add(min, max);
+        }
+
+        cmd.add("withscores", "limit", offset, count);
+        cmd.reset();
+
+        if (hotkey) hotkey->track(cmd.vec);
+
+        int len = request(cmd.toString(), 1, [&](const char* msg, const char* end){
+            if (*msg == '-') {
+                cmd.msg.assign(msg + 1, end - 2);
+                res = FAIL;
+            } else if ((res = ParseScoreMembers(msg, end, vec)) >= 0) {
+                cmd.status = res;
+                res = OK;
+            }
+        }, timeout);
+
+        return cmd.setResult(this, len < 0 ? len : res);
+    }
+
+    // 按分数从低到高(rev为true时从高到低)分页遍历[min, max]范围内的成员,每页最多count个,每页调用一次func,
+    // func返回false时停止.下一页从上一页最后的分数开始并跳过该分数已经返回的成员,服务端不需要像
+    // LIMIT offset那样跳过前面所有的成员(遍历期间有序集合被修改时可能重复或遗漏成员)
+    int zscanByScore(const string& key, const string& min, const string& max, int count, function<bool(vector<pair<string, double>>&)> func, bool rev = false){
+        vector<pair<string, double>> vec;
+        string start = rev ? max : min;
+        int64 offset = 0;
+
+        while (true) {
+            if ((rev ? zrangeByScore(key, min, start, offset, count, vec, true) : zrangeByScore(key, start, max, offset, count, vec)) < 0) return code;
+
+            if (vec.empty()) return code = OK;
+
+            double last = vec.back().second;
+            string score = FormatScore(last);
+            bool more = (int)(vec.size()) >= count;
+            int64 same = 0;
+
+            for (auto it = vec.rbegin(); it != vec.rend() && it->second == last; ++it) same++;
+
+            // 整页的分数都与上一页最后的分数相同时需要累加跳过的个数
+            offset = same == (int64)(vec.size()) && score == start ? offset + same : same;
+            start = score;
+
+            if (!func(vec) || !more) return code = OK;
+        }
+    }
+
+    // 把分数格式化为可以精确还原的字符串(用作ZRANGEBYSCORE的范围)
+    static string FormatScore(double score){
+        char buf[32];
+
+        if (std::isinf(score)) return score > 0 ? "+inf" : "-inf";
+
+        snprintf(buf, sizeof(buf), "%.17g", score);
+
+        return buf;
+    }
+
+    // 解析WITHSCORES返回的[成员, 分数, ...]数组到vec,返回成员个数,格式错误返回DATAERR
+    static int ParseScoreMembers(const char* msg, const char* tail, vector<pair<string, double>>& vec){
+        int64 sz = 0;
+        const char* end = FindLineEnd(msg + 1, tail);
+
+        if (*msg != '*' || end == NULL || !ParseInteger(msg + 1, end, sz) || sz < 0 || sz % 2) return DATAERR;
+
+        const char* str = end + 2;
+
+        vec.resize(sz / 2);
+
+        for (int64 i = 0; i < sz; i++) {
+            int64 len = 0;
+
+            if (str >= tail || *str != '$' || (end = FindLineEnd(str + 1, tail)) == NULL || !ParseInteger(str + 1, end, len) || len < 0) return DATAERR;
+
+            str = end + 2;
+
+            if (tail - str < len + 2) return DATAERR;
+
+            pair<string, double>& item = vec[i / 2];
+
+            if (i % 2 == 0) {
+                item.first.assign(str, len);
+            } else if (!ParseDouble(str, str + len, item.second)) {
+                return DATAERR;
+            }
+
+            str += len + 2;
+        }
+
+        return (int)(sz / 2);
+    }
+
+public:
+    // 结构体与哈希的映射:结构体中声明一次字段列表,
+    //     template<typename VISITOR>
+    //     void visit(VISITOR& visitor){
+    //         visitor("name", name)("age", age)("score", score);
+    //     }
+    // hsetObject用一个HSET写入所有成员,hgetObject用一个HMGET读取(回复顺序与字段列表相同,不需要按名称查找),
+    // 回复在接收缓冲区中直接解析到成员.成员的编码与解析按类型(字符串、bool、整数、浮点数)在编译期选择,
+    // 字符串成员与hset/hget一样支持值压缩
+    template<typename T>
+    int hsetObject(const string& key, const T& obj){
+        Command cmd("hset");
+        FieldWriter writer(codec.get());
+        int res = OK;
+
+        cmd.add(key);
+
+        // 写入时只读取成员
+        const_cast<T&>(obj).visit(writer);
+
+        if (writer.count == 0) return cmd.setResult(this, PARAMERR);
+
+        string data = "*" + to_string(writer.count * 2 + 2) + "\r\n$4\r\nhset\r\n";
+
+        AppendBulk(data, key.c_str(), key.size());
+        data += writer.data;
+        cmd.reset();
+
+        if (hotkey) hotkey->track(cmd.vec);
+
+        int len = request(data, 1, [&](const char* msg, const char* end){
+            res = cmd.parse(msg, end - msg);
+        }, timeout);
+
+        if (negcache) negcache->invalidate(cmd.vec);
+
+        return cmd.setResult(this, len < 0 ? len : res);
+    }
+
+    // 读取hsetObject写入的结构体,哈希中不存在的成员保持原值.成功时getStatus()返回读到的成员个数,
+    // 所有成员都不存在(键不存在)时返回NOTFOUND,成员格式错误时返回DATAERR(之前的成员已经更新)
+    template<typename T>
+    int hgetObject(const string& key, T& obj){
+        Command cmd("hmget");
+        FieldNames names;
+        int res = OK;
+
+        cmd.add(key);
+        obj.visit(names);
+
+        if (names.count == 0) return cmd.setResult(this, PARAMERR);
+
+        string data = "*" + to_string(names.count + 2) + "\r\n$5\r\nhmget\r\n";
+
+        AppendBulk(data, key.c_str(), key.size());
+        data += names.data;
+        cmd.reset();
+
+        if (hotkey) hotkey->track(cmd.vec);
+
+        int len = request(data, 1, [&](const char* msg, const char* end){
+            if (*msg == '-') {
+                cmd.msg.assign(msg + 1, end - 2);
+                res = FAIL;
+                return;
+            }
+
+            FieldReader reader(msg, end, names.count, codec.get());
+
+            if (reader.res == OK) obj.visit(reader);
+
+            if ((res = reader.res) < 0) {
+                cmd.msg = reader.msg;
+            } else {
+                cmd.status = reader.found;
+                res = reader.found > 0 ? OK : NOTFOUND;
+            }
+        }, timeout);
+
+        return cmd.setResult(this, len < 0 ? len : res);
+    }
+
+protected:
+    // 收集字段名称,作为HMGET的参数
+    struct FieldNames{
+        string data;
+        int count = 0;
+
+        template<typename T>
+        FieldNames& operator()(const char* name, const T&){
+            AppendBulk(data, name, strlen(name));
+            count++;
+            return *this;
+        }
+    };
+
+    // 把成员编码为HSET的字段与值
+    struct FieldWriter{
+        string data;
+        int count = 0;
+        RedisCodec* codec;
+
+        FieldWriter(RedisCodec* codec): codec(codec){}
+
+        template<typename T>
+        FieldWriter& operator()(const char* name, const T& val){
+            AppendBulk(data, name, strlen(name));
+            FormatField(data, val, codec);
+            count++;
+            return *this;
+        }
+    };
+
+    // 依次从HMGET回复的数组中解析每个成员
+    struct FieldReader{
+        const char* str;
+        const char* tail;
+        int64 size = 0;
+        int64 idx = 0;
+        int found = 0;
+        int res = OK;
+        string msg;
+        RedisCodec* codec;
+
+        FieldReader(const char* msg, const char* tail, int count, RedisCodec* codec): tail(tail), codec(codec){
+            const char* end = FindLineEnd(msg + 1, tail);
+
+            if (*msg != '*' || end == NULL || !ParseInteger(msg + 1, end, size) || size != count) {
+                res = DATAERR;
+                this->msg = "unexpected hmget reply";
+            }
+
+            str = end ? end + 2 : tail;
+        }
+
+        template<typename T>
+        FieldReader& operator()(const char* name, T& val){
+            int64 len = 0;
+            const char* end = NULL;
+
+            if (res < 0 || idx++ >= size) return *this;
+
+            if (str >= tail || *str != '$' || (end = FindLineEnd(str + 1, tail)) == NULL || !ParseInteger(str + 1, end, len) || (len >= 0 && tail - end - 2 < len + 2)) {
+                res = DATAERR;
+                msg = "unexpected hmget reply";
+                return *this;
+            }
+
+            str = end + 2;
+
+            // 不存在的字段为$-1
+            if (len < 0) return *this;
+
+            if (!ParseField(str, str + len, val, codec)) {
+                res = DATAERR;
+                msg = string("invalid value for field ") + name;
+                return *this;
+            }
+
+            str += len + 2;
+            found++;
+
+            return *this;
+        }
+    };
+
+    static void AppendBulk(string& out, const char* str, size_t len){
+        char buf[32];
+        int sz = snprintf(buf, sizeof(buf), "$%u\r\n", (unsigned)(len));
+
+        out.append(buf, sz);
+        out.append(str, len);
+        out.append("\r\n", 2);
+    }
+
+    static void FormatField(string& out, const string& val, RedisCodec* codec){
+        const string& data = codec ? codec->encode(val) : val;
+
+        AppendBulk(out, data.c_str(), data.size());
+    }
+
+    static void FormatField(string& out, bool val, RedisCodec*){
+        AppendBulk(out, val ? "1" : "0", 1);
+    }
+
+    template<typename T>
+    static typename enable_if<is_integral<T>::value && is_signed<T>::value>::type FormatField(string& out, T val, RedisCodec*){
+        char buf[32];
+        int sz = snprintf(buf, sizeof(buf), "%lld", (long long)(val));
+
+        AppendBulk(out, buf, sz);
+    }
+
+    template<typename T>
+    static typename enable_if<is_integral<T>::value && is_unsigned<T>::value>::type FormatField(string& out, T val, RedisCodec*){
+        char buf[32];
+        int sz = snprintf(buf, sizeof(buf), "%llu", (unsigned long long)(val));
+
+        AppendBulk(out, buf, sz);
+    }
+
+    template<typename T>
+    static typename enable_if<is_floating_point<T>::value>::type FormatField(string& out, T val, RedisCodec*){
+        char buf[32];
+        int sz = snprintf(buf, sizeof(buf), "%.17g", (double)(val));
+
+        AppendBulk(out, buf, sz);
+    }
+
+    static bool ParseField(const char* str, const char* end, string& val, RedisCodec* codec){
+        val.assign(str, end - str);
+
+        return codec == NULL || codec->decode(val);
+    }
+
+    static bool ParseField(const char* str, const char* end, bool& val, RedisCodec*){
+        int64 num = 0;
+
+        if (!ParseInteger(str, end, num)) return false;
+
+        val = num != 0;
+
+        return true;
+    }
+
+    template<typename T>
+    static typename enable_if<is_integral<T>::value && is_signed<T>::value, bool>::type ParseField(const char* str, const char* end, T& val, RedisCodec*){
+        int64 num = 0;
+
+        if (!ParseInteger(str, end, num) || num < (int64)(numeric_limits<T>::min()) || num > (int64)(numeric_limits<T>::max())) return false;
+
+        val = (T)(num);
+
+        return true;
+    }
+
+    template<typename T>
+    static typename enable_if<is_integral<T>::value && is_unsigned<T>::value, bool>::type ParseField(const char* str, const char* end, T& val, RedisCodec*){
+        u_int64 num = 0;
+
+        if (str >= end || end - str > 20) return false;
+
+        for (const char* pos = str; pos < end; pos++) {
+            if (*pos < '0' || *pos > '9' || num > (UINT64_MAX - (*pos - '0')) / 10) return false;
+            num = num * 10 + (*pos - '0');
+        }
+
+        if (num > (u_int64)(numeric_limits<T>::max())) return false;
+
+        val = (T)(num);
+
+        return true;
+    }
+
+    template<typename T>
+    static typename enable_if<is_floating_point<T>::value, bool>::type ParseField(const char* str, const char* end, T& val, RedisCodec*){
+        double num = 0;
+
+        if (!ParseDouble(str, end, num)) return false;
+
+        val = (T)(num);
+
+        return true;
+    }
+
+public:
+    // 消息流中的一条消息
+    struct StreamEntry{
+        string id;
+        vector<pair<string, string>> fields;
+    };
+
+    // 写入一条消息,maxlen大于0时使用MAXLEN ~近似裁剪,id返回消息ID
+    int xadd(const string& key, const vector<pair<string, string>>& fields, string& id, int64 maxlen = 0){
+        vector<vector<pair<string, string>>> entries(1, fields);
+        vector<string> ids;
+
+        if (xadd(key, entries, maxlen, &ids) > 0 && ids.size() > 0) {
+            id = ids[0];
+        }
+
+        return code;
+    }
+
+    // 批量写入消息,所有XADD在一次写入中发送,ids不为空时返回每条消息的ID
+    int xadd(const string& key, const vector<vector<pair<string, string>>>& entries, int64 maxlen = 0, vector<string>* ids = NULL){
+        vector<Command> cmds(entries.size(), Command("xadd"));
+
+        for (size_t i = 0; i < entries.size(); i++) {
+            Command& cmd = cmds[i];
+
+            cmd.add(key);
+
+            if (maxlen > 0) cmd.add("maxlen", "~", maxlen);
+
+            cmd.add("*");
+
+            for (const auto& item : entries[i]) cmd.add(item.first, item.second);
+        }
+
+        if (pipeline(cmds) < 0) return code;
+
+        if (ids) ids->clear();
+
+        for (Command& cmd : cmds) {
+            if (cmd.getCode() < 0) {
+                msg = cmd.getErrorString();
+                return code = cmd.getCode();
+            }
+            if (ids) ids->push_back(cmd.get(0));
+        }
+
+        return code = OK;
+    }
+
+    // 创建消费组,消费组已存在时也返回OK
+    int xgroupCreate(const string& key, const string& group, const string& id = "$"){
+        if (execute("xgroup", "create", key, group, id, "mkstream") == FAIL && msg.find("BUSYGROUP") == 0) {
+            code = OK;
+        }
+
+        return code;
+    }
+
+    // 以消费组的方式读取最多count条消息,block为阻塞等待的毫秒数(小于0表示不阻塞),
+    // id为">"读取新消息,为"0"读取本消费者已读取但未确认的消息,没有消息时返回NOTFOUND
+    int xreadgroup(const string& group, const string& consumer, const string& key, int count, int block, vector<StreamEntry>& entries, const string& id = ">"){
+        vector<Command> cmds(1);
+
+        xreadgroupCommand(cmds[0], group, consumer, key, count, block, id);
+
+        return readStream(cmds, entries, block);
+    }
+
+    // 确认消息,所有ID在一个XACK命令中发送,确认数量通过getInteger获取
+    int xack(const string& key, const string& group, const vector<string>& ids){
+        Command cmd("xack");
+
+        cmd.add(key, group);
+
+        for (const string& id : ids) cmd.add(id);
+
+        return execute(cmd);
+    }
+
+    // 认领空闲超过minIdle毫秒的待确认消息(用于恢复崩溃消费者的消息),start传入并返回下一次扫描的起点
+    int xautoclaim(const string& key, const string& group, const string& consumer, int64 minIdle, string& start, int count, vector<StreamEntry>& entries){
+        Command cmd("xautoclaim");
+        Reply reply;
+
+        entries.clear();
+        cmd.add(key, group, consumer, minIdle, start, "count", count);
+
+        if (execute(cmd, reply) < 0) return code;
+
+        if (reply.size() < 2) return code = DATAERR;
+
+        start = reply[0].getString();
+
+        ParseStreamEntries(reply[1], entries);
+
+        return code = entries.empty() ? NOTFOUND : OK;
+    }
+
+    // 消息流消费循环:每次把上一批消息的XACK与下一次XREADGROUP合并在一次写入中发送,
+    // 确认不额外占用往返;func返回true表示这批消息处理成功(需要确认),返回false时确认后退出.
+    // 等待block毫秒仍无消息时以空数组调用func.claimIdle大于0时每隔claimIdle毫秒
+    // 通过XAUTOCLAIM认领其他消费者超时未确认的消息.网络异常时自动重连
+    int consumeStream(const string& key, const string& group, const string& consumer, int count, int block, function<bool(vector<StreamEntry>&)> func, int64 claimIdle = 0){
+        bool running = true;
+        string start = "0-0";
+        vector<string> acks;
+        vector<StreamEntry> entries;
+        int64 claimTime = claimIdle > 0 ? 0 : INT64_MAX;
+
+        xgroupCreate(key, group);
+
+        while (running) {
+            vector<Command> cmds;
+
+            if (acks.size() > 0) {
+                cmds.push_back(Command("xack"));
+                cmds.back().add(key, group);
+                for (const string& id : acks) cmds.back().add(id);
+            }
+
+            if (GetMillisecond() >= claimTime) {
+                if (xautoclaim(key, group, consumer, claimIdle, start, count, entries) == NOTFOUND || start == "0-0") {
+                    claimTime = GetMillisecond() + claimIdle;
+                    start = "0-0";
+                }
+                if (code >= 0 && code != NOTFOUND && entries.size() > 0) {
+                    running = func(entries);
+                    for (const StreamEntry& item : entries) acks.push_back(item.id);
+                    continue;
+                }
+            }
+
+            cmds.push_back(Command());
+            xreadgroupCommand(cmds.back(), group, consumer, key, count, block, ">");
+
+            int res = readStream(cmds, entries, block);
+
+            // 只有XACK成功才清除,确认失败(错误回复或没有收到回复)的ID在下一轮重新确认
+            if (cmds.size() > 1 && cmds[0].getCode() == OK) acks.clear();
+
+            if (res < 0 && res != NOTFOUND) {
+                Sleep(100);
+                reconnect();
+                continue;
+            }
+
+            running = func(entries);
+
+            for (const StreamEntry& item : entries) acks.push_back(item.id);
+        }
+
+        // 退出前确认最后一批,失败时这些消息留在待确认列表中,可以被XAUTOCLAIM认领
+        if (acks.size() > 0) xack(key, group, acks);
+
+        return code;
+    }
+
+    // 解析消息数组 [[id, [field, value, ...]], ...]
+    static void ParseStreamEntries(const Reply& reply, vector<StreamEntry>& entries){
+        for (const Reply& item : reply.elements) {
+            if (item.size() < 2) continue;
+
+            StreamEntry entry;
+            const Reply& fields = item[1];
+
+            entry.id = item[0].getString();
+
+            for (size_t i = 0; i + 1 < fields.size(); i += 2) {
+                entry.fields.push_back(make_pair(fields[i].getString(), fields[i + 1].getString()));
+            }
+
+            entries.push_back(entry);
+        }
+    }
+
+protected:
+    void xreadgroupCommand(Command& cmd, const string& group, const string& consumer, const string& key, int count, int block, const string& id){
+        cmd = Command("xreadgroup");
+        cmd.add("group", group, consumer, "count", count);
+
+        if (block >= 0) cmd.add("block", block);
+
+        cmd.add("streams", key, id);
+    }
+
+    // 发送cmds(最后一个是XREADGROUP),解析XREADGROUP的回复 [[key, [entries]]]
+    int readStream(vector<Command>& cmds, vector<StreamEntry>& entries, int block){
+        vector<Reply> replies;
+
+        entries.clear();
+
+        if (pipeline(cmds, replies, block < 0 ? timeout : getBlockTimeout(block > 0 ? block / 1000 + 1 : 0)) < 0) return code;
+
+        // 只检查最后的XREADGROUP,之前合并发送的命令(如XACK)由调用者检查
+        if (cmds.back().getCode() == FAIL) {
+            msg = cmds.back().getErrorString();
+            return code = FAIL;
+        }
+
+        const Reply& reply = replies.back();
+
+        if (reply.isNull()) return code = NOTFOUND;
+
+        for (const Reply& stream : reply.elements) {
+            if (stream.size() > 1) ParseStreamEntries(stream[1], entries);
+        }
+
+        return code = entries.empty() ? NOTFOUND : OK;
+    }
+
 public:
     template<typename ...ARGS>
 	int eval(const string& lua){
@@ -800,6 +2840,7 @@ public:
 protected:
     int code = 0;  // redis当前状态，1是正常，其它都是错误
 	int port = 0;  // 端口号
+	int64 integer = 0;  // 整型回复的值
 	int memsz = 0; // 缓冲区大小
 	int status = 0;   // 
 	int timeout = 0;  // 超时时间
@@ -809,6 +2850,14 @@ protected:
 	string host;  // 主机ip地址
     int sockFd_ = INVALID_SOCKET;  // TODO:也可以在构造函数初始化
     string passwd;  // 密码
+    SocketOption sockopt;  // socket参数
+    shared_ptr<RedisCodec> codec;  // 值压缩编码,为空表示不压缩
+    shared_ptr<Executor> executor;  // 命令执行器,为空时直接读写socket
+    shared_ptr<RedisHotKey> hotkey;  // 热点键统计,为空表示不统计
+    shared_ptr<RedisNegCache> negcache;  // 未命中缓存,为空表示不缓存
+    shared_ptr<RedisBreaker> breaker;  // 熔断器,为空表示不熔断
+    int64 tracking = 0;  // 当前连接的CLIENT TRACKING重定向到的连接ID,0表示没有开启
+    int skip = 0;  // 需要丢弃的回复数(对冲读中没有被采用的回复)
 };
 
 #endif
\ No newline at end of file
@@ -1,4 +1,9 @@
 #include "RedisConnPool.h"
+#include "RedisMux.h"
+
+static int64 GetMicrosecond() {
+    return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
 
 shared_ptr<RedisConnect> RedisConnPool::Instance() {
     return GetTemplate()->GetConn();
@@ -10,26 +15,608 @@ RedisConnPool* RedisConnPool::GetTemplate(){
 }
 shared_ptr<RedisConnect> RedisConnPool::GetConn() {
     shared_ptr<RedisConnect> redis = nullptr;
-    if (connQue_.empty()){
-        cout << "RedisConnPool busy"<<endl;
-        // return nullptr;
-    } 
-    sem_wait(&semId_);
+    MarkServing();
+    if (multiplex_ > 0){
+        if (muxes_.empty()){
+            return nullptr;
+        }
+        redis = muxes_[muxIdx_++ % muxes_.size()]->getConnect();
+        redis->setCodec(codec_);
+        redis->setHotKey(hotkey_);
+        redis->setNegCache(negcache_);
+        redis->setBreaker(breaker_);
+        Lease(redis.get(), GetMicrosecond(), false);
+        return redis;
+    }
+    if (!lanes_.empty()){
+        return GetConn(0);
+    }
+    int64 stime = GetMicrosecond();
+    // 没有空闲连接时等待其它调用者归还
+    bool blocked = sem_trywait(&semId_) < 0;
+    if (blocked){
+        ++waitingCount_;
+        while (sem_wait(&semId_) < 0 && errno == EINTR){
+        }
+        --waitingCount_;
+    }
     {
         lock_guard<mutex> locker(mtx_);
         redis = connQue_.front();
         connQue_.pop();
     }
+    --freeCount_;
+    Lease(redis.get(), stime, blocked);
     return redis;
 }
 
+shared_ptr<RedisConnect> RedisConnPool::GetConn(int lane) {
+    shared_ptr<RedisConnect> redis = nullptr;
+    MarkServing();
+    if(multiplex_ > 0 || lanes_.empty()){
+        return GetConn();
+    }
+    if(lane < 0 || lane >= (int)lanes_.size()){
+        lane = 0;
+    }
+    Lane& cur = *lanes_[lane];
+    int64 stime = GetMicrosecond();
+    bool blocked = false;
+    {
+        unique_lock<mutex> locker(laneMtx_);
+        if(!CanTake(lane)){
+            blocked = true;
+            ++cur.waitingCount;
+            ++waitingCount_;
+            laneCv_.wait(locker, [&](){
+                return CanTake(lane);
+            });
+            --cur.waitingCount;
+            --waitingCount_;
+        }
+        --laneFree_;
+        ++cur.useCount;
+        // 还有空闲连接时让因优先级让出的低优先级通道重新检查
+        if(laneFree_ > 0){
+            laneCv_.notify_all();
+        }
+    }
+    {
+        lock_guard<mutex> locker(mtx_);
+        redis = connQue_.front();
+        connQue_.pop();
+        laneOf_[redis.get()] = lane;
+    }
+    --freeCount_;
+    ++cur.getCount;
+    if(blocked){
+        ++cur.blockedCount;
+    }
+    cur.waitTime.Add(GetMicrosecond() - stime);
+    Lease(redis.get(), stime, blocked);
+    return redis;
+}
+
+bool RedisConnPool::IsEligible(int lane) {
+    const Lane& cur = *lanes_[lane];
+    int unmet = 0;
+    if(laneFree_ <= 0){
+        return false;
+    }
+    // 保留的连接没有用完时总是可以获取
+    if(cur.useCount < cur.reserved){
+        return true;
+    }
+    for(size_t i = 0; i < lanes_.size(); ++i){
+        if((int)i != lane){
+            unmet += std::max(lanes_[i]->reserved - lanes_[i]->useCount, 0);
+        }
+    }
+    return laneFree_ - 1 >= unmet;
+}
+
+bool RedisConnPool::CanTake(int lane) {
+    if(!IsEligible(lane)){
+        return false;
+    }
+    // 有更高优先级的通道在等待并且可以获取时让给它
+    for(size_t i = 0; i < lanes_.size(); ++i){
+        const Lane& other = *lanes_[i];
+        if((int)i != lane && other.waitingCount > 0 && other.priority < lanes_[lane]->priority && IsEligible(i)){
+            return false;
+        }
+    }
+    return true;
+}
+
+int RedisConnPool::AddLane(const string& name, int reserved, int priority) {
+    shared_ptr<Lane> lane = make_shared<Lane>();
+    lane->name = name;
+    lane->reserved = std::max(reserved, 0);
+    lane->priority = priority;
+    lane->useCount = 0;
+    lane->waitingCount = 0;
+    lane->getCount = 0;
+    lane->blockedCount = 0;
+    lanes_.push_back(lane);
+    return lanes_.size() - 1;
+}
+
+int RedisConnPool::GetLane(const string& name) const {
+    for(size_t i = 0; i < lanes_.size(); ++i){
+        if(lanes_[i]->name == name){
+            return i;
+        }
+    }
+    return -1;
+}
+
+void RedisConnPool::GetLaneStat(vector<LaneStat>& stat) {
+    stat.clear();
+    stat.resize(lanes_.size());
+    lock_guard<mutex> locker(laneMtx_);
+    for(size_t i = 0; i < lanes_.size(); ++i){
+        const Lane& lane = *lanes_[i];
+        stat[i].name = lane.name;
+        stat[i].reserved = lane.reserved;
+        stat[i].priority = lane.priority;
+        stat[i].useCount = lane.useCount;
+        stat[i].waitingCount = lane.waitingCount;
+        stat[i].getCount = lane.getCount;
+        stat[i].blockedCount = lane.blockedCount;
+        lane.waitTime.Get(stat[i].waitTime);
+    }
+}
+
+void RedisConnPool::Lease(RedisConnect* redis, int64 stime, bool blocked) {
+    int64 now = GetMicrosecond();
+    ++getCount_;
+    if (blocked){
+        ++blockedCount_;
+    }
+    waitTime_.Add(now - stime);
+    // 多路复用句柄可以不归还,不计入借出数与占用时间
+    if (redis->getExecutor()){
+        return;
+    }
+    auto it = leases_.find(redis);
+    if (it == leases_.end()){
+        return;
+    }
+    it->second.store(now, memory_order_relaxed);
+    int count = ++useCount_;
+    int peak = peakCount_;
+    while (count > peak && !peakCount_.compare_exchange_weak(peak, count)){
+    }
+}
+
+bool RedisConnPool::Release(RedisConnect* redis) {
+    if (redis->getExecutor()){
+        return false;
+    }
+    auto it = leases_.find(redis);
+    if (it == leases_.end()){
+        return false;
+    }
+    // 重复归还时借出时间已经清零
+    int64 stime = it->second.exchange(0, memory_order_relaxed);
+    if (stime == 0){
+        return false;
+    }
+    --useCount_;
+    holdTime_.Add(GetMicrosecond() - stime);
+    return true;
+}
+
+void RedisConnPool::MarkServing() {
+    if (!serving_.load(memory_order_relaxed)){
+        serving_.store(true);
+    }
+}
+
+void RedisConnPool::GetStat(PoolStat& stat, bool resetPeak) {
+    stat.connSize = MAX_CONN_;
+    stat.useCount = useCount_;
+    stat.freeCount = freeCount_;
+    stat.peakCount = resetPeak ? peakCount_.exchange(useCount_) : peakCount_.load();
+    stat.waitingCount = waitingCount_;
+    stat.getCount = getCount_;
+    stat.blockedCount = blockedCount_;
+    waitTime_.Get(stat.waitTime);
+    holdTime_.Get(stat.holdTime);
+    stat.hedgeDelay = hedgeDelay_;
+    stat.hedgeCount = hedgeCount_;
+    stat.hedgeWinCount = hedgeWinCount_;
+}
+
+RedisConnPool::Histogram::Histogram() : count(0), sum(0), max(0) {
+    for(int i = 0; i < BUCKETS; ++i){
+        buckets[i] = 0;
+    }
+}
+
+double RedisConnPool::Histogram::Mean() const {
+    return count > 0 ? (double)sum / count : 0;
+}
+
+int64 RedisConnPool::Histogram::Percentile(double p) const {
+    int64 target = (int64)(p * count + 0.5);
+    int64 total = 0;
+    if(count == 0){
+        return 0;
+    }
+    for(int i = 0; i < BUCKETS - 1; ++i){
+        total += buckets[i];
+        if(total >= target){
+            return std::min((int64)1 << i, max);
+        }
+    }
+    return max;
+}
+
+RedisConnPool::AtomicHistogram::AtomicHistogram() : count(0), sum(0), max(0) {
+    for(int i = 0; i < Histogram::BUCKETS; ++i){
+        buckets[i] = 0;
+    }
+}
+
+void RedisConnPool::AtomicHistogram::Add(int64 val) {
+    int idx = 0;
+    if(val < 0){
+        val = 0;
+    }
+    while(idx < Histogram::BUCKETS - 1 && ((int64)1 << idx) <= val){
+        ++idx;
+    }
+    buckets[idx].fetch_add(1, memory_order_relaxed);
+    count.fetch_add(1, memory_order_relaxed);
+    sum.fetch_add(val, memory_order_relaxed);
+    int64 cur = max.load(memory_order_relaxed);
+    while(val > cur && !max.compare_exchange_weak(cur, val, memory_order_relaxed)){
+    }
+}
+
+void RedisConnPool::AtomicHistogram::Get(Histogram& hist) const {
+    for(int i = 0; i < Histogram::BUCKETS; ++i){
+        hist.buckets[i] = buckets[i].load(memory_order_relaxed);
+    }
+    hist.count = count.load(memory_order_relaxed);
+    hist.sum = sum.load(memory_order_relaxed);
+    hist.max = max.load(memory_order_relaxed);
+}
+
 void RedisConnPool::FreeConn(shared_ptr<RedisConnect> redis) {
     assert(redis);
+    // 多路复用连接的句柄不需要归还,重复归还的连接已经在队列中
+    if(!Release(redis.get())){
+        return;
+    }
+    auto it = owner_.find(redis.get());
+    if(it != owner_.end()){
+        ReplicaNode* node = it->second;
+        {
+            lock_guard<mutex> locker(mtx_);
+            node->que.push(redis);
+        }
+        ++freeCount_;
+        sem_post(&node->sem);
+        return;
+    }
+    if(!lanes_.empty()){
+        int lane = 0;
+        {
+            lock_guard<mutex> locker(mtx_);
+            auto iter = laneOf_.find(redis.get());
+            if(iter != laneOf_.end()){
+                lane = iter->second;
+                laneOf_.erase(iter);
+            }
+            connQue_.push(redis);
+        }
+        ++freeCount_;
+        {
+            lock_guard<mutex> locker(laneMtx_);
+            ++laneFree_;
+            --lanes_[lane]->useCount;
+        }
+        laneCv_.notify_all();
+        return;
+    }
     lock_guard<mutex> locker(mtx_);
     connQue_.push(redis);
+    ++freeCount_;
     sem_post(&semId_);
 }
 
+void RedisConnPool::InitReplica(const vector<pair<string, int>>& replicas, int connSize,
+                                ReplicaPolicy policy) {
+    // 其它线程已经在不加锁地读取副本与连接表,不能再修改
+    if(serving_){
+        cout << "RedisConnPool InitReplica must be called before the first GetConn" << endl;
+        return;
+    }
+    policy_ = policy;
+    for(const auto& item : replicas){
+        shared_ptr<ReplicaNode> node = make_shared<ReplicaNode>();
+        node->host = item.first;
+        node->port = item.second;
+        node->outstanding = 0;
+        node->latency = 0;
+        if(breakerEnabled_){
+            node->breaker = make_shared<RedisBreaker>(breakerOption_);
+        }
+        for(int i = 0; i < connSize; ++i){
+            shared_ptr<RedisConnect> redis = make_shared<RedisConnect>();
+            redis->setSocketOption(sockopt_);
+            redis->setCodec(codec_);
+            redis->setHotKey(hotkey_);
+            redis->setNegCache(negcache_);
+            redis->setBreaker(node->breaker);
+            if(redis->connectRedis(node->host, node->port, timeout_, memsz_) && redis->auth(passwd_) > 0){
+                node->que.push(redis);
+                owner_[redis.get()] = node.get();
+                leases_[redis.get()] = 0;
+            }
+        }
+        // 副本连接失败时不参与路由
+        if(node->que.empty()){
+            cout << "RedisConnPool replica " << node->host << ":" << node->port << " unavailable" << endl;
+            continue;
+        }
+        sem_init(&node->sem, 0, node->que.size());
+        freeCount_ += node->que.size();
+        replicas_.push_back(node);
+    }
+}
+
+shared_ptr<RedisConnect> RedisConnPool::GetReplicaConn(ReplicaNode* node) {
+    shared_ptr<RedisConnect> redis = nullptr;
+    int64 stime = GetMicrosecond();
+    bool blocked = sem_trywait(&node->sem) < 0;
+    if(blocked){
+        ++waitingCount_;
+        while(sem_wait(&node->sem) < 0 && errno == EINTR){
+        }
+        --waitingCount_;
+    }
+    {
+        lock_guard<mutex> locker(mtx_);
+        redis = node->que.front();
+        node->que.pop();
+    }
+    --freeCount_;
+    Lease(redis.get(), stime, blocked);
+    return redis;
+}
+
+shared_ptr<RedisConnect> RedisConnPool::GetReadConn() {
+    ReplicaNode* best = NULL;
+    MarkServing();
+    for(const auto& node : replicas_){
+        // 跳过熔断打开的副本,都打开时读主节点
+        if(node->breaker && node->breaker->isOpen()){
+            continue;
+        }
+        if(best == NULL){
+            best = node.get();
+        }else if(policy_ == LEAST_OUTSTANDING){
+            if(node->outstanding < best->outstanding){
+                best = node.get();
+            }
+        }else if(node->latency < best->latency){
+            best = node.get();
+        }
+    }
+    return best ? GetReplicaConn(best) : GetConn();
+}
+
+int RedisConnPool::Read(const function<int(RedisConnect*)>& func, bool fresh) {
+    MarkServing();
+    if(fresh || replicas_.empty()){
+        return Write(func);
+    }
+
+    shared_ptr<RedisConnect> redis = GetReadConn();
+    auto it = owner_.find(redis.get());
+    ReplicaNode* node = it == owner_.end() ? NULL : it->second;
+
+    if(node){
+        ++node->outstanding;
+    }
+
+    int64 stime = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    int res = func(redis.get());
+    int64 etime = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+
+    if(node){
+        --node->outstanding;
+        // 出错的请求按超时计入延迟,降低该副本被选中的概率
+        int64 cost = res < 0 && res != RedisConnect::NOTFOUND ? timeout_ * 1000LL : etime - stime;
+        node->latency = (node->latency * 7 + cost) / 8;
+    }
+
+    FreeConn(redis);
+    return res;
+}
+
+int RedisConnPool::Write(const function<int(RedisConnect*)>& func) {
+    shared_ptr<RedisConnect> redis = GetConn();
+    int res = func(redis.get());
+    FreeConn(redis);
+    return res;
+}
+
+int RedisConnPool::Write(const function<int(RedisConnect*)>& func, int lane) {
+    shared_ptr<RedisConnect> redis = GetConn(lane);
+    int res = func(redis.get());
+    FreeConn(redis);
+    return res;
+}
+
+int RedisConnPool::Execute(RedisConnect::Command& cmd, bool fresh) {
+    auto func = [&](RedisConnect* redis){
+        return redis->execute(cmd);
+    };
+    const vector<string>& args = cmd.getCommand();
+    MarkServing();
+    if(args.size() > 0 && hedgePercentile_ > 0 && multiplex_ == 0 && IsHedgeCommand(args[0])){
+        return Hedge(cmd, fresh);
+    }
+    if(args.size() > 0 && IsReadOnlyCommand(args[0])){
+        return Read(func, fresh);
+    }
+    return Write(func);
+}
+
+int RedisConnPool::Post(RedisConnect::Command& cmd) {
+    return Write([&](RedisConnect* redis){
+        return redis->post(cmd);
+    });
+}
+
+void RedisConnPool::SetHedge(double percentile, double budget, int minDelay) {
+    hedgePercentile_ = percentile;
+    hedgeBudget_ = budget;
+    hedgeMinDelay_ = minDelay;
+}
+
+bool RedisConnPool::IsHedgeCommand(const string& cmd) {
+    static const char* names[] = {
+        "get", "mget", "hget", "hmget", "hgetall", "lrange", "lindex",
+        "zrange", "zrangebyscore", "zrevrange", "zscore", "smembers", "sismember"
+    };
+    for(const char* name : names){
+        if(strcasecmp(cmd.c_str(), name) == 0){
+            return true;
+        }
+    }
+    return false;
+}
+
+int RedisConnPool::Hedge(RedisConnect::Command& cmd, bool fresh) {
+    // 每个读请求积累budget次对冲,最多积累100次
+    if(hedgeTokens_ < 100000){
+        hedgeTokens_ += (int64)(hedgeBudget_ * 1000);
+    }
+
+    shared_ptr<RedisConnect> first = fresh ? GetConn() : GetReadConn();
+    shared_ptr<RedisConnect> second = nullptr;
+    auto it = owner_.find(first.get());
+    ReplicaNode* node = it == owner_.end() ? NULL : it->second;
+    RedisConnect* winner = first.get();
+    int64 delay = hedgeDelay_;
+    int64 stime = GetMicrosecond();
+    int res = 0;
+
+    if(node){
+        ++node->outstanding;
+    }
+
+    if(delay <= 0){
+        res = first->execute(cmd);
+    }else{
+        res = first->hedge(cmd, delay, [&]() -> RedisConnect* {
+            int64 tokens = hedgeTokens_;
+            do{
+                if(tokens < 1000){
+                    return NULL;
+                }
+            }while(!hedgeTokens_.compare_exchange_weak(tokens, tokens - 1000));
+            if(!(second = TryGetConn(node, fresh))){
+                hedgeTokens_ += 1000;
+                return NULL;
+            }
+            ++hedgeCount_;
+            return second.get();
+        }, &winner);
+    }
+
+    int64 cost = GetMicrosecond() - stime;
+    if(res >= 0 || res == RedisConnect::NOTFOUND){
+        AddHedgeSample(cost);
+    }
+    if(second && winner == second.get()){
+        ++hedgeWinCount_;
+    }
+    // 对冲胜出时第一个副本的延迟至少为cost + delay
+    if(node){
+        --node->outstanding;
+        int64 sample = res < 0 && res != RedisConnect::NOTFOUND ? timeout_ * 1000LL
+                     : (winner == first.get() ? cost : cost + delay);
+        node->latency = (node->latency * 7 + sample) / 8;
+    }
+
+    FreeConn(first);
+    if(second){
+        FreeConn(second);
+    }
+    return res;
+}
+
+shared_ptr<RedisConnect> RedisConnPool::TryGetConn(ReplicaNode* exclude, bool fresh) {
+    shared_ptr<RedisConnect> redis = nullptr;
+    int64 stime = GetMicrosecond();
+    if(!fresh){
+        for(const auto& node : replicas_){
+            if(node.get() == exclude || sem_trywait(&node->sem) < 0){
+                continue;
+            }
+            {
+                lock_guard<mutex> locker(mtx_);
+                redis = node->que.front();
+                node->que.pop();
+            }
+            break;
+        }
+    }
+    if(!redis){
+        if(sem_trywait(&semId_) < 0){
+            return nullptr;
+        }
+        lock_guard<mutex> locker(mtx_);
+        redis = connQue_.front();
+        connQue_.pop();
+    }
+    --freeCount_;
+    Lease(redis.get(), stime, false);
+    return redis;
+}
+
+void RedisConnPool::AddHedgeSample(int64 cost) {
+    const size_t count = 1024;
+    lock_guard<mutex> locker(hedgeMtx_);
+    if(hedgeSamples_.size() < count){
+        hedgeSamples_.push_back(cost);
+    }else{
+        hedgeSamples_[hedgeIdx_ % count] = cost;
+    }
+    // 每64个样本重新计算一次分位数
+    if(++hedgeIdx_ % 64 == 0){
+        vector<int64> vec(hedgeSamples_);
+        size_t pos = std::min((size_t)(hedgePercentile_ * vec.size()), vec.size() - 1);
+        nth_element(vec.begin(), vec.begin() + pos, vec.end());
+        hedgeDelay_ = std::max(vec[pos], (int64)hedgeMinDelay_);
+    }
+}
+
+bool RedisConnPool::IsReadOnlyCommand(const string& cmd) {
+    static const char* names[] = {
+        "get", "mget", "strlen", "getrange", "exists", "ttl", "pttl", "type",
+        "hget", "hmget", "hgetall", "hlen", "hexists", "hkeys", "hvals", "hstrlen", "hscan",
+        "lrange", "llen", "lindex",
+        "smembers", "sismember", "scard", "srandmember", "sscan",
+        "zrange", "zrangebyscore", "zrevrange", "zrevrangebyscore", "zscore", "zcard",
+        "zcount", "zrank", "zrevrank", "zscan",
+        "xrange", "xrevrange", "xlen", "scan", "keys"
+    };
+    for(const char* name : names){
+        if(strcasecmp(cmd.c_str(), name) == 0){
+            return true;
+        }
+    }
+    return false;
+}
+
 int RedisConnPool::GetFreeConnCount() {
     lock_guard<mutex> locker(mtx_);
     return connQue_.size();
@@ -38,11 +625,49 @@ int RedisConnPool::GetFreeConnCount() {
 void RedisConnPool::Init(const string& host, int port, const string& pwd = "",
                          int connSize = 8, int timeout = 3000, 
                          int memsz = 2 * 1024 * 1024) {
+    passwd_ = pwd;
+    timeout_ = timeout;
+    memsz_ = memsz;
+    host_ = host;
+    port_ = port;
+    if(breakerEnabled_ && !breaker_){
+        breaker_ = make_shared<RedisBreaker>(breakerOption_);
+    }
+    // 所有连接(包括多路复用连接每次GetConn返回的对象)共享同一个编码器
+    if(compress_ > 0 && !codec_){
+        codec_ = make_shared<RedisCodec>(compress_);
+    }
+    if(negcache_ && tracking_ && !trackingThread_.joinable()){
+        // 订阅连接建立之前不使用缓存
+        negcache_->setTracking(host_, port_, -1);
+        trackingRunning_ = true;
+        trackingThread_ = std::thread([this](){
+            RunTracking();
+        });
+    }
+    if(multiplex_ > 0){
+        for(int i = 0; i < multiplex_; ++i){
+            shared_ptr<RedisMultiplexer> mux = make_shared<RedisMultiplexer>();
+            if(mux->connect(host, port, pwd, timeout, memsz, ioLoop_)){
+                muxes_.push_back(mux);
+            }
+        }
+        MAX_CONN_ = muxes_.size();
+        cout << "多路复用连接数" << MAX_CONN_ << endl;
+        sem_init(&semId_, 0, 0);
+        return;
+    }
     for(int i = 0; i < connSize; ++i){
         shared_ptr<RedisConnect> redis = make_shared<RedisConnect>();
+        redis->setSocketOption(sockopt_);
+        redis->setCodec(codec_);
+        redis->setHotKey(hotkey_);
+        redis->setNegCache(negcache_);
+        redis->setBreaker(breaker_);
         if(redis && redis->connectRedis(host, port, timeout, memsz)){
             if(redis->auth(pwd)){
                 connQue_.push(redis);
+                leases_[redis.get()] = 0;
             }
         }
         if(!redis){
@@ -51,19 +676,137 @@ void RedisConnPool::Init(const string& host, int port, const string& pwd = "",
     }
     MAX_CONN_ = connSize;
     cout << "最大连接数" << MAX_CONN_ << endl;
-    sem_init(&semId_, 0, MAX_CONN_);
+    // 信号量按实际建立成功的连接数初始化,否则GetConn可能从空队列中取连接
+    freeCount_ += connQue_.size();
+    if(!lanes_.empty()){
+        int reserved = 0;
+        for(const auto& lane : lanes_){
+            reserved += lane->reserved;
+        }
+        if(reserved > (int)connQue_.size()){
+            cout << "RedisConnPool lanes reserve " << reserved << " connections, only " << connQue_.size() << " available" << endl;
+        }
+        // 通道模式下由laneFree_计数,信号量保持为0(对冲读不会取到主节点连接)
+        laneFree_ = connQue_.size();
+        sem_init(&semId_, 0, 0);
+        return;
+    }
+    sem_init(&semId_, 0, connQue_.size());
+}
+
+void RedisConnPool::SetSocketOption(const RedisConnect::SocketOption& option) {
+    sockopt_ = option;
+}
+
+void RedisConnPool::SetCompress(int threshold) {
+    compress_ = threshold;
+}
+
+void RedisConnPool::SetMultiplex(int count) {
+    multiplex_ = count;
+}
+
+void RedisConnPool::SetHotKey(const shared_ptr<RedisHotKey>& hotkey) {
+    hotkey_ = hotkey;
+}
+
+const shared_ptr<RedisHotKey>& RedisConnPool::GetHotKey() const {
+    return hotkey_;
+}
+
+void RedisConnPool::SetNegCache(const shared_ptr<RedisNegCache>& cache, bool tracking) {
+    negcache_ = cache;
+    tracking_ = tracking;
+}
+
+const shared_ptr<RedisNegCache>& RedisConnPool::GetNegCache() const {
+    return negcache_;
+}
+
+void RedisConnPool::SetBreaker(const RedisBreaker::Option& option) {
+    breakerEnabled_ = true;
+    breakerOption_ = option;
+}
+
+void RedisConnPool::GetBreakers(vector<pair<string, shared_ptr<RedisBreaker>>>& breakers) {
+    breakers.clear();
+    if(breaker_){
+        breakers.push_back(make_pair(host_ + ":" + to_string(port_), breaker_));
+    }
+    for(const auto& node : replicas_){
+        if(node->breaker){
+            breakers.push_back(make_pair(node->host + ":" + to_string(node->port), node->breaker));
+        }
+    }
+}
+
+void RedisConnPool::RunTracking() {
+    RedisConnect::Reply reply;
+    while(trackingRunning_){
+        RedisConnect redis;
+        RedisConnect::Command cmd("client");
+        cmd.add("id");
+        redis.setSocketOption(sockopt_);
+        if(!redis.connectRedis(host_, port_, timeout_, memsz_) || redis.auth(passwd_) < 0 ||
+           redis.execute(cmd) < 0 || redis.execute("subscribe", "__redis__:invalidate") < 0){
+            Sleep(1000);
+            continue;
+        }
+        // 订阅之前的失效通知已经丢失,清空缓存后再使用新的连接ID
+        negcache_->clear();
+        negcache_->setTracking(host_, port_, cmd.getInteger());
+        int res = RedisConnect::OK;
+        while(trackingRunning_ && (res >= 0 || res == RedisConnect::TIMEOUT)){
+            // 失效消息为["message", "__redis__:invalidate", [键...]],键为nil表示清空了整个数据库
+            res = redis.recvReply(INT_MAX, [&](const char* msg, const char* end){
+                if(RedisConnect::ParseReply(msg, end, end, &reply) < 0 || !reply.isArray() || reply.size() != 3 ||
+                   reply[0].getString() != "message"){
+                    return;
+                }
+                if(reply[2].isNull()){
+                    negcache_->clear();
+                    return;
+                }
+                for(const auto& item : reply[2].elements){
+                    negcache_->invalidate(item.getString());
+                }
+            }, 1000);
+        }
+        negcache_->setTracking(host_, port_, -1);
+        negcache_->clear();
+    }
+}
+
+void RedisConnPool::SetIoLoop(const shared_ptr<RedisIoLoop>& loop) {
+    ioLoop_ = loop;
 }
 
 void RedisConnPool::ClosePool() {
+    if(trackingThread_.joinable()){
+        trackingRunning_ = false;
+        trackingThread_.join();
+    }
+    for(const auto& mux : muxes_){
+        mux->close();
+    }
     lock_guard<mutex> locker(mtx_);
     while(!connQue_.empty()){
         auto item = connQue_.front();
         connQue_.pop();
         // 关闭连接
     }
+    for(const auto& node : replicas_){
+        while(!node->que.empty()){
+            node->que.pop();
+        }
+    }
 }
 
-RedisConnPool::RedisConnPool() : useCount_(0), freeCount_(0) {
+RedisConnPool::RedisConnPool() : hedgePercentile_(0), hedgeBudget_(0.05), hedgeMinDelay_(500),
+    hedgeDelay_(0), hedgeTokens_(0), hedgeCount_(0), hedgeWinCount_(0), hedgeIdx_(0), MAX_CONN_(0), useCount_(0), freeCount_(0), peakCount_(0),
+    waitingCount_(0), getCount_(0), blockedCount_(0), compress_(0), timeout_(3000),
+    memsz_(2 * 1024 * 1024), policy_(LOWEST_LATENCY), serving_(false), muxIdx_(0), multiplex_(0),
+    tracking_(false), port_(0), trackingRunning_(false), laneFree_(0), breakerEnabled_(false) {
 
 }
 
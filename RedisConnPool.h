@@ -1,6 +1,7 @@
 #ifndef REDISCONNPOOL
 #define REDISCONNPOOL
 #include <ctime>
+#include <climits>
 #include <queue>
 #include <mutex>
 #include <semaphore.h>
@@ -14,35 +15,265 @@
 #include <typeinfo>
 #include <algorithm>
 #include <functional>
+#include <condition_variable>
+#include <unordered_map>
 
 #include "typedef.h"
 #include "RedisConn.h"
 
 using namespace std;
 
+// 多路复用连接与事件循环只在RedisConnPool.cpp中使用,调用SetIoLoop时需要包含RedisIoLoop.h
+class RedisIoLoop;
+class RedisMultiplexer;
+
 class RedisConnPool {
+public:
+    RedisConnPool();
+    ~RedisConnPool();
+
+public:
+    // 只读命令选择副本的策略
+    enum ReplicaPolicy {
+        LOWEST_LATENCY = 0,     // 最近测得延迟最低的副本
+        LEAST_OUTSTANDING = 1   // 未完成请求最少的副本
+    };
+
+    // 耗时分布(微秒),第i个桶统计[2^(i-1), 2^i)微秒,最后一个桶包含更大的值
+    struct Histogram {
+        static const int BUCKETS = 24;
+
+        int64 buckets[BUCKETS];
+        int64 count;
+        int64 sum;
+        int64 max;
+
+        Histogram();
+        double Mean() const;
+        // 估计的百分位数(返回所在桶的上界),p取值0~1
+        int64 Percentile(double p) const;
+    };
+
+    // 连接池状态快照
+    struct PoolStat {
+        int connSize;       // 主节点连接数(其余计数包含副本连接)
+        int useCount;       // 当前借出的连接数(不含多路复用句柄)
+        int freeCount;      // 当前空闲的连接数
+        int peakCount;      // 借出连接数的峰值(GetStat传入resetPeak时从当前值重新统计)
+        int waitingCount;   // 正在GetConn中等待的调用者数
+        int64 getCount;     // GetConn(含副本)总次数
+        int64 blockedCount; // 需要等待空闲连接的次数
+        Histogram waitTime; // GetConn等待时间
+        Histogram holdTime; // 连接从借出到归还的时间(不含多路复用句柄)
+        int64 hedgeDelay;   // 当前的对冲等待时间(微秒),0表示样本不足、暂不对冲
+        int64 hedgeCount;   // 发出的对冲请求数
+        int64 hedgeWinCount;// 对冲请求先返回的次数
+    };
+
+    // 优先级通道状态快照
+    struct LaneStat {
+        string name;
+        int reserved;       // 保留的连接数
+        int priority;       // 优先级,越小越优先
+        int useCount;       // 当前借出的连接数(不含多路复用句柄)
+        int waitingCount;   // 正在等待的调用者数
+        int64 getCount;     // 获取连接的总次数
+        int64 blockedCount; // 需要等待的次数
+        Histogram waitTime; // 等待时间
+    };
+
 public:
     static shared_ptr<RedisConnect> Instance();
     static RedisConnPool *GetTemplate();
     shared_ptr<RedisConnect> GetConn();
     void FreeConn(shared_ptr<RedisConnect> conn);
     int GetFreeConnCount();
+    // host支持unix:/path/to/redis.sock形式的unix域套接字地址
     void Init(const string& host, int port, const string& pwd,
                          int connSize, int timeout, 
                          int memsz);
     void ClosePool();
+    // 设置连接池中连接的socket参数,需要在Init之前调用
+    void SetSocketOption(const RedisConnect::SocketOption& option);
+    // 设置连接池中连接的值压缩阈值(见RedisConnect::setCompress),需要在Init之前调用
+    void SetCompress(int threshold);
+    // 开启热点键统计,需要在Init之前调用,连接池中的所有连接(包括副本与多路复用连接)共享hotkey
+    void SetHotKey(const shared_ptr<RedisHotKey>& hotkey);
+    const shared_ptr<RedisHotKey>& GetHotKey() const;
+    // 开启未命中缓存,需要在Init之前调用,连接池中的所有连接共享cache.tracking为true时Init会建立一条订阅
+    // __redis__:invalidate的连接,主节点连接读取键时开启CLIENT TRACKING,其它客户端修改键后缓存立即失效;
+    // 订阅连接断开期间缓存暂停使用.副本与多路复用连接只查询缓存,不缓存读到的未命中
+    void SetNegCache(const shared_ptr<RedisNegCache>& cache, bool tracking = false);
+    const shared_ptr<RedisNegCache>& GetNegCache() const;
+    // 开启熔断,需要在Init之前调用:主节点与每个副本各有一个RedisBreaker(见RedisBreaker::Option),
+    // 节点不可用时请求在微秒内返回CIRCUITOPEN,出错的连接在熔断放行后自动重连;只读命令不选择熔断打开的副本
+    void SetBreaker(const RedisBreaker::Option& option = RedisBreaker::Option());
+    // 获取各节点(host:port)的熔断器,第一个为主节点
+    void GetBreakers(vector<pair<string, shared_ptr<RedisBreaker>>>& breakers);
+    // 多路复用模式:需要在Init之前调用,Init时只建立count条多路复用连接(RedisMultiplexer),
+    // GetConn不再等待空闲连接,各线程的命令在同一条连接上自动合并为pipeline发送.
+    // 该模式下不要通过连接池执行阻塞命令(BLPOP等)和WATCH/MULTI等依赖连接状态的命令
+    void SetMultiplex(int count);
+    // 多路复用模式下由事件循环(io_uring或epoll)驱动所有多路复用连接,需要在Init之前调用,
+    // loop需要已经start,同一个事件循环可以被多个连接池共享
+    void SetIoLoop(const shared_ptr<RedisIoLoop>& loop);
+    // 优先级通道:需要在Init之前调用,返回通道编号.每个通道保留reserved条主节点连接只给本通道使用,
+    // 其余连接由所有通道共享,借用共享连接时不会占用其它通道还没有用到的保留连接;
+    // 等待空闲连接时priority小的通道先得到连接.添加通道后GetConn()使用第一个通道,
+    // 副本与多路复用连接不区分通道,对冲读不再使用主节点连接
+    int AddLane(const string& name, int reserved = 0, int priority = 0);
+    // 按名称查找通道编号,不存在时返回-1
+    int GetLane(const string& name) const;
+    // 从指定通道获取主节点连接,用完后同样调用FreeConn
+    shared_ptr<RedisConnect> GetConn(int lane);
+    // 使用指定通道在主节点上执行操作
+    int Write(const function<int(RedisConnect*)>& func, int lane);
+
+    // 读写分离:在Init之后、第一次获取连接之前调用(已经获取过连接时拒绝执行),为每个副本建立connSize个连接
+    // (密码与超时参数同Init),只读命令发往副本,写命令总是发往主节点
+    void InitReplica(const vector<pair<string, int>>& replicas, int connSize = 8,
+                     ReplicaPolicy policy = LOWEST_LATENCY);
+    // 按策略选择一个副本并获取连接,没有可用副本时返回主节点连接,用完后同样调用FreeConn
+    shared_ptr<RedisConnect> GetReadConn();
+    // 在副本上执行只读操作,fresh为true时读主节点(读到自己刚写入的数据)
+    int Read(const function<int(RedisConnect*)>& func, bool fresh = false);
+    // 在主节点上执行操作
+    int Write(const function<int(RedisConnect*)>& func);
+    // 根据命令名称路由:只读命令发往副本,其它命令发往主节点
+    int Execute(RedisConnect::Command& cmd, bool fresh = false);
+    // 单向写入不需要回复的命令(见RedisConnect::post),连接只在写入期间被占用,不等待往返.
+    // 大量写入时使用RedisNoReply,不占用连接池中的连接
+    int Post(RedisConnect::Command& cmd);
+    static bool IsReadOnlyCommand(const string& cmd);
+
+    // 对冲读:开启后Execute执行幂等的读命令(见IsHedgeCommand)时,如果在最近延迟的percentile分位数
+    // (不低于minDelay微秒)内没有收到回复,就在另一个副本或连接上再发送一次,采用先到达的回复.
+    // budget限制对冲请求占读请求的比例,没有空闲连接时不对冲;percentile小于等于0时关闭.多路复用模式下不对冲
+    void SetHedge(double percentile = 0.95, double budget = 0.05, int minDelay = 500);
+    static bool IsHedgeCommand(const string& cmd);
+
+    // 获取连接池状态,开销很小,可以每秒采集一次;resetPeak为true时峰值从当前借出数重新统计
+    void GetStat(PoolStat& stat, bool resetPeak = false);
+    // 获取各通道的状态,用来观察通道之间是否相互影响
+    void GetLaneStat(vector<LaneStat>& stat);
      
 private:
-    RedisConnPool();
-    ~RedisConnPool();
+    // 原子更新的耗时分布
+    struct AtomicHistogram {
+        atomic<int64> buckets[Histogram::BUCKETS];
+        atomic<int64> count;
+        atomic<int64> sum;
+        atomic<int64> max;
+
+        AtomicHistogram();
+        void Add(int64 val);
+        void Get(Histogram& hist) const;
+    };
+
+    int Hedge(RedisConnect::Command& cmd, bool fresh);
+    void AddHedgeSample(int64 cost);
+
+    // 借出、归还连接时更新统计,多路复用句柄只计入获取次数与等待时间.
+    // Release返回false表示连接不是借出状态(重复归还、多路复用句柄或不属于连接池),不应放回队列
+    void Lease(RedisConnect* redis, int64 stime, bool blocked);
+    bool Release(RedisConnect* redis);
+    // 标记连接池已经开始使用,之后leases_、owner_与replicas_只读不加锁,InitReplica不再修改它们
+    void MarkServing();
+
+    double hedgePercentile_;  // 对冲等待时间取最近延迟的分位数,0表示不对冲
+    double hedgeBudget_;      // 对冲请求占读请求的比例上限
+    int hedgeMinDelay_;       // 对冲等待时间下限(微秒)
+    atomic<int64> hedgeDelay_;   // 当前的对冲等待时间(微秒)
+    atomic<int64> hedgeTokens_;  // 可用的对冲次数(千分之一次)
+    atomic<int64> hedgeCount_;
+    atomic<int64> hedgeWinCount_;
+    std::mutex hedgeMtx_;
+    vector<int64> hedgeSamples_;  // 最近的读延迟(微秒),由hedgeMtx_保护
+    size_t hedgeIdx_;
 
     int MAX_CONN_;   // 最大的连接数
-    int useCount_;   //  当前的用户数
-    int freeCount_;  //  空闲的用户数，没用上
+    atomic<int> useCount_;   // 当前借出的连接数
+    atomic<int> freeCount_;  // 当前空闲的连接数
+    atomic<int> peakCount_;  // 借出连接数的峰值
+    atomic<int> waitingCount_;  // 正在等待连接的调用者数
+    atomic<int64> getCount_;
+    atomic<int64> blockedCount_;
+    AtomicHistogram waitTime_;
+    AtomicHistogram holdTime_;
+    // 池中每条连接的借出时间(微秒,0表示空闲),在Init/InitReplica中建立,之后只读不加锁;多路复用句柄不记录
+    std::unordered_map<RedisConnect*, atomic<int64>> leases_;
+
+    // 副本节点,每个节点有自己的连接队列
+    struct ReplicaNode {
+        string host;
+        int port;
+        sem_t sem;
+        std::queue<shared_ptr<RedisConnect>> que;
+        atomic<int> outstanding;   // 未完成的请求数
+        atomic<int64> latency;     // 延迟的指数移动平均值(微秒)
+        shared_ptr<RedisBreaker> breaker;  // 节点的熔断器,为空表示不熔断
+    };
+
+    shared_ptr<RedisConnect> GetReplicaConn(ReplicaNode* node);
+
+    // 优先级通道,useCount与waitingCount由laneMtx_保护
+    struct Lane {
+        string name;
+        int reserved;
+        int priority;
+        int useCount;
+        int waitingCount;
+        atomic<int64> getCount;
+        atomic<int64> blockedCount;
+        AtomicHistogram waitTime;
+    };
+
+    // 通道lane能否立即获取连接(需要持有laneMtx_)
+    bool CanTake(int lane);
+    bool IsEligible(int lane);
+    // 订阅服务端失效通知并使未命中缓存中的键失效,断开后每秒重连一次
+    void RunTracking();
+    // 不等待地获取一个对冲用的连接,优先选择exclude以外的副本
+    shared_ptr<RedisConnect> TryGetConn(ReplicaNode* exclude, bool fresh);
+
+    RedisConnect::SocketOption sockopt_;  // socket参数
+    int compress_;   // 值压缩阈值,0表示不压缩
+    shared_ptr<RedisCodec> codec_;  // 所有连接共享的值压缩编码器
+    shared_ptr<RedisHotKey> hotkey_;  // 热点键统计
+    string passwd_;  // 密码
+    int timeout_;    // 超时时间
+    int memsz_;      // 缓冲区大小
+
+    ReplicaPolicy policy_;  // 副本选择策略
+    vector<shared_ptr<ReplicaNode>> replicas_;
+    std::unordered_map<RedisConnect*, ReplicaNode*> owner_;  // 副本连接所属的节点
+    atomic<bool> serving_;  // 是否已经有调用者获取过连接
+
+    vector<shared_ptr<RedisMultiplexer>> muxes_;  // 多路复用连接
+    atomic<u_int32> muxIdx_;  // 轮询选择多路复用连接
+    int multiplex_;  // 多路复用连接数,0表示不使用多路复用
+    shared_ptr<RedisIoLoop> ioLoop_;  // 驱动多路复用连接的事件循环
 
     std::queue<shared_ptr<RedisConnect>> connQue_;
     std::mutex mtx_;
     sem_t semId_;
+
+    shared_ptr<RedisNegCache> negcache_;  // 未命中缓存
+    bool tracking_;  // 是否开启服务端失效通知
+    string host_;  // 主节点地址(用于建立订阅连接)
+    int port_;
+    std::thread trackingThread_;
+    atomic<bool> trackingRunning_;
+
+    vector<shared_ptr<Lane>> lanes_;
+    std::unordered_map<RedisConnect*, int> laneOf_;  // 借出的主节点连接所属的通道,由mtx_保护
+    std::mutex laneMtx_;
+    condition_variable laneCv_;
+    int laneFree_;  // 通道模式下空闲的主节点连接数,由laneMtx_保护
+
+    bool breakerEnabled_;  // 是否开启熔断
+    RedisBreaker::Option breakerOption_;
+    shared_ptr<RedisBreaker> breaker_;  // 主节点的熔断器
 };
 
 #endif
@@ -0,0 +1,230 @@
+#include "RedisCounter.h"
+
+RedisCounter::RedisCounter() : pool_(NULL), interval_(100), maxKeys_(1000), pending_(0),
+    running_(false), signaled_(false) {
+    for(int i = 0; i < 16; ++i){
+        stripes_.push_back(make_shared<Stripe>());
+    }
+}
+
+RedisCounter::~RedisCounter() {
+    Stop();
+}
+
+bool RedisCounter::Start(RedisConnPool* pool, int interval, int maxKeys, int stripes) {
+    if(running_ || pool == NULL || interval <= 0 || stripes <= 0){
+        return false;
+    }
+    pool_ = pool;
+    interval_ = interval;
+    maxKeys_ = maxKeys;
+    // 分段数只能在还没有增量时修改
+    if(pending_ == 0 && (int)stripes_.size() != stripes){
+        stripes_.clear();
+        for(int i = 0; i < stripes; ++i){
+            stripes_.push_back(make_shared<Stripe>());
+        }
+    }
+    signaled_ = false;
+    running_ = true;
+    worker_ = std::thread([this](){
+        Run();
+    });
+    return true;
+}
+
+void RedisCounter::Stop() {
+    if(running_){
+        {
+            lock_guard<mutex> locker(mtx_);
+            running_ = false;
+        }
+        cv_.notify_all();
+        worker_.join();
+    }
+    Flush();
+}
+
+void RedisCounter::Run() {
+    unique_lock<mutex> locker(mtx_);
+    while(running_){
+        cv_.wait_for(locker, chrono::milliseconds(interval_), [this](){
+            return signaled_ || !running_;
+        });
+        signaled_ = false;
+        if(!running_){
+            break;
+        }
+        locker.unlock();
+        Flush();
+        locker.lock();
+    }
+}
+
+RedisCounter::Stripe& RedisCounter::GetStripe(const string& key) {
+    return *stripes_[std::hash<string>()(key) % stripes_.size()];
+}
+
+void RedisCounter::Add(Stripe& stripe, int64 now) {
+    if(stripe.first == 0 || now < stripe.first){
+        stripe.first = now;
+    }
+    // 计数器个数达到maxKeys时唤醒后台线程立即刷新
+    if(++pending_ == maxKeys_ && running_){
+        {
+            lock_guard<mutex> locker(mtx_);
+            signaled_ = true;
+        }
+        cv_.notify_one();
+    }
+}
+
+void RedisCounter::Incr(const string& key, int64 val) {
+    Stripe& stripe = GetStripe(key);
+    int64 now = RedisConnect::GetMillisecond();
+    ++stat_.incrCount;
+    lock_guard<mutex> locker(stripe.mtx);
+    auto res = stripe.incr.insert(make_pair(key, val));
+    if(res.second){
+        Add(stripe, now);
+    }else{
+        res.first->second += val;
+    }
+}
+
+void RedisCounter::Decr(const string& key, int64 val) {
+    Incr(key, -val);
+}
+
+void RedisCounter::HIncr(const string& key, const string& field, int64 val) {
+    Stripe& stripe = GetStripe(key);
+    int64 now = RedisConnect::GetMillisecond();
+    ++stat_.incrCount;
+    lock_guard<mutex> locker(stripe.mtx);
+    auto res = stripe.hincr[key].insert(make_pair(field, val));
+    if(res.second){
+        Add(stripe, now);
+    }else{
+        res.first->second += val;
+    }
+}
+
+int RedisCounter::Flush() {
+    lock_guard<mutex> flushLocker(flushMtx_);
+    int64 now = RedisConnect::GetMillisecond();
+    int64 first = 0;
+    vector<RedisConnect::Command> cmds;
+    // 与cmds一一对应,失败时把增量合并回去
+    vector<pair<Stripe*, int>> owners;
+    unordered_map<string, int64> incr;
+    unordered_map<string, unordered_map<string, int64>> hincr;
+
+    if(pool_ == NULL){
+        return RedisConnect::PARAMERR;
+    }
+
+    for(const auto& item : stripes_){
+        Stripe& stripe = *item;
+        {
+            lock_guard<mutex> locker(stripe.mtx);
+            if(stripe.first == 0){
+                continue;
+            }
+            if(first == 0 || stripe.first < first){
+                first = stripe.first;
+            }
+            stripe.first = 0;
+            incr.clear();
+            hincr.clear();
+            incr.swap(stripe.incr);
+            hincr.swap(stripe.hincr);
+        }
+        for(const auto& kv : incr){
+            --pending_;
+            // 增减相互抵消的计数器不需要发送
+            if(kv.second == 0){
+                continue;
+            }
+            cmds.push_back(RedisConnect::Command("incrby"));
+            cmds.back().add(kv.first, kv.second);
+            owners.push_back(make_pair(&stripe, 0));
+        }
+        for(const auto& kv : hincr){
+            for(const auto& fv : kv.second){
+                --pending_;
+                if(fv.second == 0){
+                    continue;
+                }
+                cmds.push_back(RedisConnect::Command("hincrby"));
+                cmds.back().add(kv.first, fv.first, fv.second);
+                owners.push_back(make_pair(&stripe, 1));
+            }
+        }
+    }
+
+    if(cmds.empty()){
+        return RedisConnect::OK;
+    }
+
+    stat_.lastLag = now - first;
+    if(stat_.lastLag > stat_.maxLag){
+        stat_.maxLag = stat_.lastLag.load();
+    }
+    ++stat_.flushCount;
+    stat_.commandCount += cmds.size();
+
+    int res = pool_->Write([&](RedisConnect* redis){
+        return redis->pipeline(cmds);
+    });
+
+    for(size_t i = 0; i < cmds.size(); ++i){
+        RedisConnect::Command& cmd = cmds[i];
+        if(cmd.getCode() >= 0){
+            continue;
+        }
+        ++stat_.errorCount;
+        // 没有收到回复的增量合并回去,下一次刷新时重试(错误回复如WRONGTYPE不重试)
+        if(cmd.getCode() != RedisConnect::NETERR){
+            continue;
+        }
+        const vector<string>& args = cmd.getCommand();
+        Stripe& stripe = *owners[i].first;
+        lock_guard<mutex> locker(stripe.mtx);
+        if(owners[i].second == 0){
+            auto ret = stripe.incr.insert(make_pair(args[1], atoll(args[2].c_str())));
+            if(ret.second){
+                Add(stripe, first);
+            }else{
+                ret.first->second += atoll(args[2].c_str());
+            }
+        }else{
+            auto ret = stripe.hincr[args[1]].insert(make_pair(args[2], atoll(args[3].c_str())));
+            if(ret.second){
+                Add(stripe, first);
+            }else{
+                ret.first->second += atoll(args[3].c_str());
+            }
+        }
+    }
+
+    return res;
+}
+
+int64 RedisCounter::GetFlushLag() {
+    int64 first = 0;
+    for(const auto& item : stripes_){
+        lock_guard<mutex> locker(item->mtx);
+        if(item->first > 0 && (first == 0 || item->first < first)){
+            first = item->first;
+        }
+    }
+    return first == 0 ? 0 : RedisConnect::GetMillisecond() - first;
+}
+
+int RedisCounter::GetPendingCount() const {
+    return pending_;
+}
+
+const RedisCounter::Stat& RedisCounter::GetStat() const {
+    return stat_;
+}
@@ -0,0 +1,89 @@
+#ifndef REDISCOUNTER
+#define REDISCOUNTER
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <thread>
+#include <functional>
+#include <unordered_map>
+#include <condition_variable>
+
+#include "typedef.h"
+#include "RedisConnPool.h"
+
+using namespace std;
+
+// 计数器写合并:Incr/HIncr只在本地按键累加,后台线程每隔interval毫秒(或累积的不同计数器
+// 达到maxKeys个时)把所有增量合并为一批INCRBY/HINCRBY,通过一次pipeline写入redis.
+// 累加结构按键分成多个分段(stripe),每个分段一把锁,减少多线程同时计数时的锁竞争.
+// 网络错误时没有收到回复的增量会合并回下一次刷新(连接在执行过程中断开时可能重复计数)
+class RedisCounter {
+public:
+    // 统计信息
+    struct Stat {
+        atomic<int64> incrCount;     // Incr/HIncr调用次数
+        atomic<int64> flushCount;    // 刷新次数
+        atomic<int64> commandCount;  // 发送的INCRBY/HINCRBY命令数
+        atomic<int64> errorCount;    // 执行失败的命令数
+        atomic<int64> lastLag;       // 最近一次刷新时最早的增量已等待的时间(毫秒)
+        atomic<int64> maxLag;        // lastLag的最大值
+
+        Stat() : incrCount(0), flushCount(0), commandCount(0), errorCount(0),
+                 lastLag(0), maxLag(0) {}
+    };
+
+public:
+    RedisCounter();
+    // 析构时停止后台线程并刷新剩余的增量
+    ~RedisCounter();
+
+    // 启动后台刷新线程,interval为刷新间隔(毫秒),maxKeys为触发立即刷新的计数器个数
+    bool Start(RedisConnPool* pool, int interval = 100, int maxKeys = 1000, int stripes = 16);
+    // 停止后台线程并刷新剩余的增量
+    void Stop();
+
+    void Incr(const string& key, int64 val = 1);
+    void Decr(const string& key, int64 val = 1);
+    void HIncr(const string& key, const string& field, int64 val = 1);
+
+    // 立即刷新,返回pipeline的结果
+    int Flush();
+    // 尚未刷新的增量中最早的一个已等待的时间(毫秒),没有待刷新的增量时返回0
+    int64 GetFlushLag();
+    // 尚未刷新的计数器个数
+    int GetPendingCount() const;
+    const Stat& GetStat() const;
+
+private:
+    struct Stripe {
+        mutex mtx;
+        int64 first;  // 最早的增量加入的时间,0表示没有增量
+        unordered_map<string, int64> incr;
+        unordered_map<string, unordered_map<string, int64>> hincr;
+
+        Stripe() : first(0) {}
+    };
+
+    Stripe& GetStripe(const string& key);
+    void Add(Stripe& stripe, int64 now);
+    void Run();
+
+    RedisConnPool* pool_;
+    int interval_;
+    int maxKeys_;
+
+    vector<shared_ptr<Stripe>> stripes_;
+    atomic<int> pending_;  // 尚未刷新的计数器个数
+    std::mutex flushMtx_;  // 保证同一时间只有一个刷新在执行
+
+    atomic<bool> running_;
+    std::thread worker_;
+    std::mutex mtx_;
+    condition_variable cv_;
+    bool signaled_;
+
+    Stat stat_;
+};
+
+#endif
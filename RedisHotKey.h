@@ -0,0 +1,378 @@
+#ifndef REDIS_HOT_KEY
+#define REDIS_HOT_KEY
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include "typedef.h"
+
+using namespace std;
+
+// 热点键统计:按采样率对执行的命令抽样,用count-min sketch统计(命令, 键)的访问次数,
+// 每种命令保留估计次数最多的topK个键.计数只使用原子操作,只有新键可能进入topK时才加锁,
+// 可以在生产环境常开.计数每隔window毫秒减半,使结果反映最近的访问情况
+class RedisHotKey{
+public:
+    static const int DEPTH = 4;  // sketch的行数
+    static const int MAX_GROUP = 64;  // 最多统计的命令种类
+
+    struct Item{
+        string key;
+        u_int64 count;  // 估计的访问次数(已按采样率放大)
+
+        Item(): count(0){}
+        Item(const string& key, u_int64 count): key(key), count(count){}
+    };
+
+    struct Stat{
+        atomic<int64> sampled;  // 抽中的命令数
+        atomic<int64> keys;     // 计入sketch的键数
+        atomic<int64> locked;   // 为更新topK加锁的次数
+
+        Stat(): sampled(0), keys(0), locked(0){}
+    };
+
+protected:
+    // 一种命令的topK,hashes可以不加锁读取,用来判断键是否已经在topK中
+    struct Group{
+        string name;
+        mutex mtx;
+        atomic<u_int32> floor;  // 进入topK需要达到的估计次数(可能偏低,加锁后重新计算)
+        vector<string> keys;
+        vector<atomic<u_int64>> hashes;
+
+        Group(const string& name, int topK): name(name), floor(0), keys(topK), hashes(topK){
+            for (auto& item : hashes) item = 0;
+        }
+    };
+
+public:
+    // width为sketch每行的计数器个数(向上取整为2的幂),sampleRate为每sampleRate个命令抽样一个
+    RedisHotKey(int topK = 16, int sampleRate = 16, int width = 4096, int window = 60000, int minCount = 4)
+        : topK(max(topK, 1)), sampleRate(max(sampleRate, 1)), window(window), minCount(minCount), lastDecay(GetMillisecond()){
+        int size = 1024;
+        while (size < width) size <<= 1;
+        mask = size - 1;
+        table = vector<atomic<u_int32>>(DEPTH * size);
+        for (auto& item : table) item = 0;
+        for (auto& item : groups) item = NULL;
+    }
+
+    ~RedisHotKey(){
+        for (auto& item : groups){
+            delete item.load();
+        }
+    }
+
+    // 统计一条命令(args[0]为命令名称)中的键
+    void track(const vector<string>& args){
+        if (args.size() < 2 || !sample()){
+            return;
+        }
+
+        char name[32];
+        const string& cmd = args[0];
+        int len = min((int)(cmd.size()), (int)(sizeof(name)) - 1);
+
+        for (int i = 0; i < len; i++){
+            name[i] = tolower(cmd[i]);
+        }
+        name[len] = 0;
+
+        ++stat.sampled;
+
+        Group* group = getGroup(name, len);
+        if (group == NULL){
+            return;
+        }
+
+        if (IsMultiKey(name)){
+            for (size_t i = 1; i < args.size(); i++) add(group, args[i]);
+        } else if (strcmp(name, "mset") == 0 || strcmp(name, "msetnx") == 0){
+            for (size_t i = 1; i < args.size(); i += 2) add(group, args[i]);
+        } else if (strcmp(name, "eval") == 0 || strcmp(name, "evalsha") == 0){
+            size_t num = args.size() > 2 ? atoi(args[2].c_str()) : 0;
+            for (size_t i = 3; i < args.size() && i < num + 3; i++) add(group, args[i]);
+        } else if (strcmp(name, "xread") == 0 || strcmp(name, "xreadgroup") == 0){
+            // STREAMS之后前一半参数是键,后一半是ID
+            for (size_t i = 1; i < args.size(); i++){
+                if (strcasecmp(args[i].c_str(), "streams") == 0){
+                    size_t num = (args.size() - i - 1) / 2;
+                    for (size_t j = i + 1; j <= i + num; j++) add(group, args[j]);
+                    break;
+                }
+            }
+        } else if (!IsKeyless(name)){
+            add(group, args[1]);
+        }
+    }
+
+    // 估计的访问次数(已按采样率放大)
+    u_int64 estimate(const string& cmd, const string& key) const{
+        u_int64 hash = KeyHash(Hash(cmd.c_str(), cmd.size()), key);
+        return (u_int64)(count(hash)) * sampleRate;
+    }
+
+    // 获取一种命令访问最多的键(按次数从大到小)
+    void getTopKeys(const string& cmd, vector<Item>& vec) const{
+        vec.clear();
+        for (auto& item : groups){
+            Group* group = item.load(memory_order_acquire);
+            if (group && strcasecmp(group->name.c_str(), cmd.c_str()) == 0){
+                getTopKeys(group, vec);
+                return;
+            }
+        }
+    }
+
+    // 获取所有命令访问最多的键
+    void getTopKeys(map<string, vector<Item>>& res) const{
+        res.clear();
+        for (auto& item : groups){
+            Group* group = item.load(memory_order_acquire);
+            if (group){
+                getTopKeys(group, res[group->name]);
+            }
+        }
+    }
+
+    // 所有计数减半
+    void decay(){
+        for (auto& item : table){
+            item.store(item.load(memory_order_relaxed) >> 1, memory_order_relaxed);
+        }
+        for (auto& item : groups){
+            Group* group = item.load(memory_order_acquire);
+            if (group) group->floor = group->floor >> 1;
+        }
+    }
+
+    // 清空所有计数与topK
+    void clear(){
+        for (auto& item : table){
+            item = 0;
+        }
+        for (auto& item : groups){
+            Group* group = item.load(memory_order_acquire);
+            if (group == NULL){
+                continue;
+            }
+            lock_guard<mutex> lk(group->mtx);
+            for (int i = 0; i < topK; i++){
+                group->keys[i].clear();
+                group->hashes[i] = 0;
+            }
+            group->floor = 0;
+        }
+    }
+
+    int getSampleRate() const{
+        return sampleRate;
+    }
+
+    const Stat& getStat() const{
+        return stat;
+    }
+
+protected:
+    static int64 GetMillisecond(){
+        return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static u_int64 Hash(const char* data, int len){
+        u_int64 h = 14695981039346656037ULL;
+        for (int i = 0; i < len; i++){
+            h ^= (u_char)(tolower(data[i]));
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    static u_int64 KeyHash(u_int64 seed, const string& key){
+        u_int64 h = seed;
+        for (size_t i = 0; i < key.size(); i++){
+            h ^= (u_char)(key[i]);
+            h *= 1099511628211ULL;
+        }
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h | 1;  // 0表示topK中的空位置
+    }
+
+    static bool IsMultiKey(const char* name){
+        static const char* names[] = {"mget", "del", "unlink", "exists", "touch", "watch", "sinter", "sunion", "sdiff"};
+        for (const char* item : names){
+            if (strcmp(name, item) == 0) return true;
+        }
+        return false;
+    }
+
+    // 第一个参数不是键的命令
+    static bool IsKeyless(const char* name){
+        static const char* names[] = {"auth", "select", "ping", "echo", "info", "config", "client", "script",
+                                      "scan", "multi", "exec", "discard", "unwatch", "flushdb", "flushall", "cluster"};
+        for (const char* item : names){
+            if (strcmp(name, item) == 0) return true;
+        }
+        return false;
+    }
+
+    bool sample(){
+        static thread_local u_int32 seed = 0;
+
+        if (sampleRate <= 1){
+            return true;
+        }
+        if (seed == 0){
+            seed = (u_int32)((size_t)(&seed) ^ GetMillisecond()) | 1;
+        }
+
+        // xorshift32
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+
+        return seed % sampleRate == 0;
+    }
+
+    // 查找命令对应的Group,不存在时创建
+    Group* getGroup(const char* name, int len){
+        u_int32 idx = Hash(name, len) % MAX_GROUP;
+
+        for (int i = 0; i < MAX_GROUP; i++, idx = (idx + 1) % MAX_GROUP){
+            Group* group = groups[idx].load(memory_order_acquire);
+
+            if (group == NULL){
+                lock_guard<mutex> lk(mtx);
+                if ((group = groups[idx].load(memory_order_acquire)) == NULL){
+                    group = new Group(name, topK);
+                    groups[idx].store(group, memory_order_release);
+                    return group;
+                }
+            }
+            if (group->name == name){
+                return group;
+            }
+        }
+
+        return NULL;
+    }
+
+    u_int32 count(u_int64 hash) const{
+        u_int32 res = UINT32_MAX;
+        u_int32 h1 = (u_int32)(hash);
+        u_int32 h2 = (u_int32)(hash >> 32) | 1;
+
+        for (int i = 0; i < DEPTH; i++){
+            res = min(res, table[i * (mask + 1) + ((h1 + i * h2) & mask)].load(memory_order_relaxed));
+        }
+
+        return res;
+    }
+
+    void add(Group* group, const string& key){
+        u_int64 hash = KeyHash(Hash(group->name.c_str(), group->name.size()), key);
+        u_int32 h1 = (u_int32)(hash);
+        u_int32 h2 = (u_int32)(hash >> 32) | 1;
+        atomic<u_int32>* cells[DEPTH];
+        u_int32 vals[DEPTH];
+        u_int32 est = UINT32_MAX;
+
+        ++stat.keys;
+
+        for (int i = 0; i < DEPTH; i++){
+            cells[i] = &table[i * (mask + 1) + ((h1 + i * h2) & mask)];
+            vals[i] = cells[i]->load(memory_order_relaxed);
+            est = min(est, vals[i]);
+        }
+
+        // conservative update:只增加等于最小值的计数器,降低高估
+        for (int i = 0; i < DEPTH; i++){
+            if (vals[i] == est) cells[i]->fetch_add(1, memory_order_relaxed);
+        }
+        est++;
+
+        if (window > 0){
+            int64 now = GetMillisecond();
+            int64 last = lastDecay.load(memory_order_relaxed);
+            if (now - last > window && lastDecay.compare_exchange_strong(last, now)){
+                decay();
+            }
+        }
+
+        if ((int)(est) < minCount || est < group->floor.load(memory_order_relaxed)){
+            return;
+        }
+
+        // 已经在topK中的键不需要加锁,查询时按sketch估计次数
+        for (int i = 0; i < topK; i++){
+            if (group->hashes[i].load(memory_order_relaxed) == hash) return;
+        }
+
+        lock_guard<mutex> lk(group->mtx);
+        int pos = -1;
+        u_int32 low = UINT32_MAX;
+
+        ++stat.locked;
+
+        for (int i = 0; i < topK; i++){
+            u_int64 val = group->hashes[i].load(memory_order_relaxed);
+            if (val == hash){
+                return;
+            }
+            u_int32 cnt = val ? count(val) : 0;
+            if (cnt < low){
+                low = cnt;
+                pos = i;
+            }
+        }
+
+        if (est > low){
+            group->keys[pos] = key;
+            group->hashes[pos].store(hash, memory_order_relaxed);
+            low = UINT32_MAX;
+            for (int i = 0; i < topK; i++){
+                u_int64 val = group->hashes[i].load(memory_order_relaxed);
+                low = min(low, val ? count(val) : 0);
+            }
+        }
+
+        group->floor.store(low, memory_order_relaxed);
+    }
+
+    void getTopKeys(Group* group, vector<Item>& vec) const{
+        lock_guard<mutex> lk(group->mtx);
+
+        for (int i = 0; i < topK; i++){
+            u_int64 hash = group->hashes[i].load(memory_order_relaxed);
+            if (hash){
+                vec.push_back(Item(group->keys[i], (u_int64)(count(hash)) * sampleRate));
+            }
+        }
+
+        sort(vec.begin(), vec.end(), [](const Item& a, const Item& b){
+            return a.count > b.count;
+        });
+    }
+
+protected:
+    int topK;
+    int sampleRate;
+    int window;
+    int minCount;  // 估计次数(采样后)达到minCount才考虑进入topK
+    u_int32 mask;
+    vector<atomic<u_int32>> table;  // DEPTH行计数器
+    atomic<Group*> groups[MAX_GROUP];  // 按命令名称开放寻址
+    atomic<int64> lastDecay;
+    mutex mtx;  // 创建Group
+    Stat stat;
+};
+
+#endif
@@ -0,0 +1,1165 @@
+#ifndef REDIS_IO_LOOP
+#define REDIS_IO_LOOP
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <condition_variable>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include "RedisConn.h"
+
+// io_uring后端用到6.0以上内核头文件中的定义(缓冲区环、multishot recv、带超时参数的io_uring_enter),
+// 头文件不存在或版本较低时只编译epoll后端;定义REDIS_NO_IO_URING可以强制不编译io_uring后端(所有编译单元需要一致)
+#if !defined(REDIS_NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(IORING_RECV_MULTISHOT) && defined(IORING_FEAT_EXT_ARG)
+#define REDIS_IO_URING
+#endif
+#endif
+#endif
+
+using namespace std;
+
+// 多条连接共享的网络事件循环:由一个线程驱动所有连接的发送与接收.
+// 优先使用io_uring,一次io_uring_enter批量提交所有连接的send/recv并等待完成事件,
+// 内核支持时使用multishot recv(接收缓冲区为注册给内核的缓冲区环),否则使用注册的固定缓冲区READ_FIXED;
+// io_uring不可用(内核版本低或被禁用)时在运行时退回epoll,没有编译io_uring后端时(见REDIS_IO_URING)只使用epoll
+class RedisIoLoop{
+public:
+    enum Backend{
+        AUTO = 0,   // 优先io_uring,不可用时使用epoll
+        URING = 1,  // 只使用io_uring
+        EPOLL = 2   // 只使用epoll
+    };
+
+    // 统计信息,syscalls / 请求数即每个请求平均的系统调用次数
+    struct Stat{
+        atomic<int64> syscalls;     // 事件循环与唤醒产生的系统调用次数
+        atomic<int64> sendCount;    // 发送操作次数
+        atomic<int64> recvCount;    // 收到数据的次数
+        atomic<int64> wakeupCount;  // 唤醒事件循环的次数
+
+        Stat(): syscalls(0), sendCount(0), recvCount(0), wakeupCount(0){}
+    };
+
+    // 由事件循环驱动的连接,除onReconnect外回调都在事件循环线程中执行
+    class Channel{
+    public:
+        virtual ~Channel(){}
+
+        // 把待发送的数据追加到data,返回追加的请求数
+        virtual int onSend(string& data) = 0;
+        // 处理收到的数据,返回已处理的字节数,数据错误时返回错误码
+        virtual int onRecv(const char* data, int len) = 0;
+        // 连接异常(或连接断开期间有新的请求),未完成的请求应该返回code
+        virtual void onError(int code) = 0;
+        // 重新连接,返回新的socket,失败返回INVALID_SOCKET;
+        // 在重连线程中调用(可以阻塞),期间事件循环线程仍可能调用onError
+        virtual SOCKET onReconnect() = 0;
+        // 是否有等待回复的请求
+        virtual bool isWaiting() = 0;
+
+    private:
+        friend class RedisIoLoop;
+
+        enum State{
+            IDLE = 0,     // 未加入事件循环
+            LIVE = 1,     // 正常收发
+            BROKEN = 2,   // 连接异常,等待重连
+            CLOSING = 3   // 正在移出事件循环
+        };
+
+        int slot = -1;         // 在事件循环中的序号(对应接收缓冲区)
+        SOCKET sock = INVALID_SOCKET;
+        u_int32 gen = 0;       // 每次(重)连接加一,用于丢弃旧连接的完成事件
+        int state = IDLE;
+        int ops = 0;           // 内核中尚未完成的操作数,为0时才能关闭或重连socket
+        int timeout = 3000;
+        bool sending = false;
+        bool recving = false;
+        bool reconnecting = false;  // 已交给重连线程,结果返回前不能重连或移除
+        char* data = NULL;     // 接收缓冲区
+        int readed = 0;
+        string sendBuf;        // 发送中的数据,发送完成前不能修改
+        size_t sendPos = 0;
+        int64 last = 0;        // 最近一次收到数据(或开始等待回复)的时间
+        int64 retry = 0;       // 下一次重连的时间
+    };
+
+protected:
+    enum{
+        OP_EVENT = 1,
+        OP_SEND = 2,
+        OP_RECV = 3
+    };
+
+    static const int WAIT_TIME = 100;         // 事件等待时间(毫秒),也是超时与重连检查的周期
+    static const int RETRY_TIME = 100;        // 重连失败后的重试间隔(毫秒)
+    static const int PBUF_COUNT = 256;        // multishot recv缓冲区环的缓冲区个数
+    static const int PBUF_SIZE = 16 * 1024;   // multishot recv缓冲区环的缓冲区大小
+
+public:
+    RedisIoLoop(){
+    }
+
+    ~RedisIoLoop(){
+        stop();
+    }
+
+    // 启动事件循环,最多支持maxConn条连接,每条连接的接收缓冲区为bufSize字节(单个回复不能超过该大小)
+    bool start(Backend backend = AUTO, int maxConn = 64, int bufSize = 2 * 1024 * 1024, bool multishot = true){
+        if (running || maxConn <= 0 || bufSize <= 0){
+            return false;
+        }
+
+        this->maxConn = maxConn;
+        this->bufSize = bufSize;
+        this->multishot = multishot;
+        slots.assign(maxConn, NULL);
+        used.assign(maxConn, false);
+
+        // 接收缓冲区按需分配物理内存
+        memSize = (size_t)(maxConn) * bufSize;
+        mem = (char*)mmap(NULL, memSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mem == MAP_FAILED){
+            mem = NULL;
+            return false;
+        }
+
+        if ((efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0){
+            release();
+            return false;
+        }
+
+        if (backend != EPOLL && initUring()){
+            this->backend = URING;
+        } else if (backend != URING && initEpoll()){
+            this->backend = EPOLL;
+        } else{
+            release();
+            return false;
+        }
+
+        signaled = false;
+        running = true;
+        worker = thread([this](){ run(); });
+        connector = thread([this](){ reconnectLoop(); });
+
+        return true;
+    }
+
+    // 停止事件循环,仍在事件循环中的连接上未完成的请求返回NETERR
+    void stop(){
+        {
+            lock_guard<mutex> lk(mtx);
+            if (!running){
+                return;
+            }
+            running = false;
+            wakeup();
+        }
+        connCv.notify_all();
+
+        // 重连线程等待正在进行的重连结束
+        worker.join();
+        connector.join();
+
+        for (Channel* ch : slots){
+            if (ch){
+                ch->reconnecting = false;
+                ch->state = Channel::IDLE;
+                ch->onError(RedisConnect::NETERR);
+            }
+        }
+
+        {
+            lock_guard<mutex> lk(mtx);
+            for (Channel* ch : slots){
+                if (ch) ch->slot = -1;
+            }
+            for (Channel* ch : attaching){
+                ch->slot = -1;
+                ch->state = Channel::IDLE;
+            }
+            for (Channel* ch : detaching){
+                ch->slot = -1;
+            }
+            attaching.clear();
+            detaching.clear();
+            pending.clear();
+            connecting.clear();
+            reconnected.clear();
+            slots.assign(maxConn, NULL);
+            used.assign(maxConn, false);
+        }
+        cv.notify_all();
+
+        release();
+    }
+
+    Backend getBackend() const{
+        return backend;
+    }
+
+    // 是否正在使用multishot recv
+    bool isMultishot() const{
+        return backend == URING && multishot;
+    }
+
+    const Stat& getStat() const{
+        return stat;
+    }
+
+    // 把已连接的socket加入事件循环,没有空闲位置时返回false
+    bool attach(Channel* ch, SOCKET sock, int timeout){
+        lock_guard<mutex> lk(mtx);
+
+        if (!running){
+            return false;
+        }
+
+        for (int i = 0; i < maxConn; i++){
+            if (used[i]){
+                continue;
+            }
+            used[i] = true;
+            ch->slot = i;
+            ch->sock = sock;
+            ch->timeout = timeout;
+            ch->data = mem + (size_t)(i) * bufSize;
+            attaching.push_back(ch);
+            wakeup();
+            return true;
+        }
+
+        return false;
+    }
+
+    // 把连接移出事件循环,返回后事件循环不再访问ch与它的socket
+    void detach(Channel* ch){
+        unique_lock<mutex> lk(mtx);
+
+        if (ch->slot < 0){
+            return;
+        }
+
+        detaching.push_back(ch);
+        wakeup();
+        cv.wait(lk, [ch](){ return ch->slot < 0; });
+    }
+
+    // 通知事件循环ch有新的数据需要发送
+    void notify(Channel* ch){
+        {
+            lock_guard<mutex> lk(mtx);
+            if (running && ch->slot >= 0){
+                pending.push_back(ch);
+                wakeup();
+                return;
+            }
+        }
+        ch->onError(RedisConnect::NETERR);
+    }
+
+protected:
+    static int64 GetMillisecond(){
+        return RedisConnect::GetMillisecond();
+    }
+
+    static u_int64 Tag(int slot, u_int32 gen, int op){
+        return ((u_int64)(slot) << 32) | ((u_int64)(gen & 0xFFFFFF) << 8) | op;
+    }
+
+    // 唤醒事件循环线程(调用时需要持有mtx)
+    void wakeup(){
+        if (signaled){
+            return;
+        }
+
+        u_int64 val = 1;
+
+        signaled = true;
+        ++stat.syscalls;
+        ++stat.wakeupCount;
+
+        if (::write(efd, &val, sizeof(val)) < 0){
+            signaled = false;
+        }
+    }
+
+    void run(){
+        while (running){
+            processLists();
+
+            if (backend == URING){
+                waitUring(hasBroken() ? 10 : WAIT_TIME);
+            } else{
+                poll(hasBroken() ? 10 : WAIT_TIME);
+            }
+
+            tick();
+        }
+    }
+
+    // 处理其它线程提交的加入、移出与发送通知
+    void processLists(){
+        {
+            lock_guard<mutex> lk(mtx);
+            signaled = false;
+            attachList.swap(attaching);
+            detachList.swap(detaching);
+            notifyList.swap(pending);
+            reconnectList.swap(reconnected);
+        }
+
+        for (Channel* ch : attachList){
+            slots[ch->slot] = ch;
+            setup(ch);
+        }
+
+        // 重连线程的结果,重连期间被移出的连接由tick移除
+        for (auto& item : reconnectList){
+            Channel* ch = item.first;
+
+            ch->reconnecting = false;
+
+            if (ch->state != Channel::BROKEN){
+                continue;
+            }
+
+            if (item.second == INVALID_SOCKET){
+                ch->retry = GetMillisecond() + RETRY_TIME;
+            } else{
+                ch->sock = item.second;
+                setup(ch);
+            }
+        }
+
+        for (Channel* ch : notifyList){
+            if (ch->state == Channel::LIVE){
+                trySend(ch);
+            } else if (ch->state == Channel::BROKEN){
+                ch->onError(RedisConnect::NETERR);
+            }
+        }
+
+        for (Channel* ch : detachList){
+            disconnect(ch, RedisConnect::NETERR);
+            ch->state = Channel::CLOSING;
+        }
+
+        attachList.clear();
+        detachList.clear();
+        notifyList.clear();
+        reconnectList.clear();
+    }
+
+    bool hasBroken() const{
+        for (Channel* ch : slots){
+            if (ch && ch->state != Channel::LIVE) return true;
+        }
+        return false;
+    }
+
+    // 超时检查、重连与移出连接
+    void tick(){
+        int64 now = GetMillisecond();
+
+        for (Channel* ch : slots){
+            if (ch == NULL){
+                continue;
+            }
+
+            if (ch->state == Channel::LIVE){
+                if (now - ch->last > ch->timeout){
+                    if (ch->isWaiting()){
+                        disconnect(ch, RedisConnect::TIMEOUT);
+                    } else{
+                        ch->last = now;
+                    }
+                }
+            } else if (ch->ops > 0 || ch->reconnecting){
+                continue;
+            } else if (ch->state == Channel::CLOSING){
+                remove(ch);
+            } else if (ch->state == Channel::BROKEN && now >= ch->retry){
+                // 连接与认证是阻塞的(最长为连接超时),交给重连线程,结果由processLists处理
+                ch->reconnecting = true;
+                {
+                    lock_guard<mutex> lk(mtx);
+                    connecting.push_back(ch);
+                }
+                connCv.notify_one();
+            }
+        }
+    }
+
+    // 重连线程:依次重连交给它的连接,完成后唤醒事件循环
+    void reconnectLoop(){
+        unique_lock<mutex> lk(mtx);
+
+        while (true){
+            connCv.wait(lk, [this](){ return !running || !connecting.empty(); });
+
+            if (!running){
+                return;
+            }
+
+            Channel* ch = connecting.front();
+            connecting.erase(connecting.begin());
+
+            lk.unlock();
+            SOCKET sock = ch->onReconnect();
+            lk.lock();
+
+            reconnected.push_back(make_pair(ch, sock));
+            wakeup();
+        }
+    }
+
+    void setup(Channel* ch){
+        ch->state = Channel::LIVE;
+        ch->gen++;
+        ch->readed = 0;
+        ch->sendBuf.clear();
+        ch->sendPos = 0;
+        ch->sending = false;
+        ch->recving = false;
+        ch->last = GetMillisecond();
+
+        if (backend == EPOLL){
+            epoll_event ev;
+
+            fcntl(ch->sock, F_SETFL, fcntl(ch->sock, F_GETFL) | O_NONBLOCK);
+
+            ev.events = EPOLLIN;
+            ev.data.u64 = Tag(ch->slot, ch->gen, OP_RECV);
+            stat.syscalls += 3;
+
+            if (epoll_ctl(epfd, EPOLL_CTL_ADD, ch->sock, &ev) < 0){
+                disconnect(ch, RedisConnect::NETERR);
+                return;
+            }
+        } else{
+            armRecv(ch);
+        }
+
+        trySend(ch);
+    }
+
+    // 连接异常:中止内核中的操作,让未完成的请求失败,之后由tick重连
+    void disconnect(Channel* ch, int code){
+        if (ch->state != Channel::LIVE){
+            return;
+        }
+
+        ch->state = Channel::BROKEN;
+        ch->retry = GetMillisecond();
+        ch->readed = 0;
+
+        if (backend == EPOLL){
+            epoll_ctl(epfd, EPOLL_CTL_DEL, ch->sock, NULL);
+            ch->sending = false;
+            ++stat.syscalls;
+        }
+
+        // shutdown让内核中挂起的send/recv立即完成
+        shutdown(ch->sock, SHUT_RDWR);
+        ++stat.syscalls;
+
+        ch->onError(code);
+    }
+
+    void remove(Channel* ch){
+        slots[ch->slot] = NULL;
+        {
+            lock_guard<mutex> lk(mtx);
+            used[ch->slot] = false;
+            pending.erase(std::remove(pending.begin(), pending.end(), ch), pending.end());
+            ch->slot = -1;
+            ch->state = Channel::IDLE;
+        }
+        cv.notify_all();
+    }
+
+    // 把收到的数据交给连接处理,保留不完整的回复
+    void deliver(Channel* ch){
+        int len = 0;
+
+        ch->data[ch->readed] = 0;
+        ch->last = GetMillisecond();
+
+        if ((len = ch->onRecv(ch->data, ch->readed)) < 0){
+            disconnect(ch, len);
+            return;
+        }
+
+        if (len > 0){
+            memmove(ch->data, ch->data + len, ch->readed - len);
+            ch->readed -= len;
+        }
+
+        if (ch->readed >= bufSize - 1){
+            disconnect(ch, RedisConnect::PARAMERR);
+        }
+    }
+
+    // 取出待发送的请求并发送
+    void trySend(Channel* ch){
+        if (ch->state != Channel::LIVE || ch->sending){
+            return;
+        }
+
+        if (backend == URING){
+            if (!fill(ch)){
+                return;
+            }
+            submitSend(ch);
+            return;
+        }
+
+        while (ch->state == Channel::LIVE){
+            if (ch->sendPos >= ch->sendBuf.size() && !fill(ch)){
+                return;
+            }
+
+            int len = ::send(ch->sock, ch->sendBuf.data() + ch->sendPos, ch->sendBuf.size() - ch->sendPos, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+            ++stat.syscalls;
+            ++stat.sendCount;
+
+            if (len > 0){
+                ch->sendPos += len;
+                continue;
+            }
+
+            if (len < 0 && errno == EINTR){
+                continue;
+            }
+
+            if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+                epoll_event ev;
+
+                ev.events = EPOLLIN | EPOLLOUT;
+                ev.data.u64 = Tag(ch->slot, ch->gen, OP_RECV);
+                ch->sending = true;
+                ++stat.syscalls;
+                epoll_ctl(epfd, EPOLL_CTL_MOD, ch->sock, &ev);
+
+                return;
+            }
+
+            disconnect(ch, RedisConnect::NETERR);
+        }
+    }
+
+    // 从连接取出待发送的数据,没有数据时返回false
+    bool fill(Channel* ch){
+        bool idle = !ch->isWaiting();
+
+        ch->sendBuf.clear();
+        ch->sendPos = 0;
+
+        if (ch->onSend(ch->sendBuf) <= 0){
+            return false;
+        }
+
+        // 从空闲开始等待回复,超时从现在开始计算
+        if (idle){
+            ch->last = GetMillisecond();
+        }
+
+        return true;
+    }
+
+// epoll
+protected:
+    bool initEpoll(){
+        epoll_event ev;
+
+        if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0){
+            return false;
+        }
+
+        ev.events = EPOLLIN;
+        ev.data.u64 = Tag(0, 0, OP_EVENT);
+
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, efd, &ev) < 0){
+            ::close(epfd);
+            epfd = -1;
+            return false;
+        }
+
+        events.resize(maxConn + 1);
+
+        return true;
+    }
+
+    void poll(int timeout){
+        int num = epoll_wait(epfd, &events[0], events.size(), timeout);
+
+        ++stat.syscalls;
+
+        for (int i = 0; i < num; i++){
+            u_int64 tag = events[i].data.u64;
+            u_int32 flags = events[i].events;
+
+            if ((tag & 0xFF) == OP_EVENT){
+                u_int64 val;
+                ++stat.syscalls;
+                if (::read(efd, &val, sizeof(val)) < 0){
+                }
+                continue;
+            }
+
+            Channel* ch = slots[tag >> 32];
+
+            if (ch == NULL || ch->state != Channel::LIVE || Tag(ch->slot, ch->gen, OP_RECV) != tag){
+                continue;
+            }
+
+            if (flags & (EPOLLIN | EPOLLERR | EPOLLHUP)){
+                int len = ::recv(ch->sock, ch->data + ch->readed, bufSize - 1 - ch->readed, MSG_DONTWAIT);
+
+                ++stat.syscalls;
+
+                if (len > 0){
+                    ++stat.recvCount;
+                    ch->readed += len;
+                    deliver(ch);
+                } else if (len == 0){
+                    disconnect(ch, RedisConnect::NETCLOSE);
+                } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+                    disconnect(ch, RedisConnect::NETERR);
+                }
+            }
+
+            if ((flags & EPOLLOUT) && ch->state == Channel::LIVE && ch->sending){
+                epoll_event ev;
+
+                ev.events = EPOLLIN;
+                ev.data.u64 = tag;
+                ch->sending = false;
+                ++stat.syscalls;
+                epoll_ctl(epfd, EPOLL_CTL_MOD, ch->sock, &ev);
+
+                trySend(ch);
+            }
+        }
+    }
+
+// io_uring
+#ifdef REDIS_IO_URING
+protected:
+    static int UringSetup(u_int32 entries, io_uring_params* params){
+#ifdef __NR_io_uring_setup
+        return syscall(__NR_io_uring_setup, entries, params);
+#else
+        errno = ENOSYS;
+        return -1;
+#endif
+    }
+
+    int uringEnter(u_int32 submit, u_int32 wait, u_int32 flags, void* arg, size_t size){
+#ifdef __NR_io_uring_enter
+        ++stat.syscalls;
+        return syscall(__NR_io_uring_enter, ringFd, submit, wait, flags, arg, size);
+#else
+        errno = ENOSYS;
+        return -1;
+#endif
+    }
+
+    int uringRegister(u_int32 opcode, void* arg, u_int32 count){
+#ifdef __NR_io_uring_register
+        return syscall(__NR_io_uring_register, ringFd, opcode, arg, count);
+#else
+        errno = ENOSYS;
+        return -1;
+#endif
+    }
+
+    bool initUring(){
+        io_uring_params params;
+        u_int32 entries = 64;
+
+        while ((int)(entries) < maxConn * 2 + 8 && entries < 4096){
+            entries <<= 1;
+        }
+
+        memset(&params, 0, sizeof(params));
+
+        if ((ringFd = UringSetup(entries, &params)) < 0){
+            return false;
+        }
+
+        // 需要单次mmap映射两个环以及带超时参数的io_uring_enter(5.11+)
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG) || !probe()){
+            releaseUring();
+            return false;
+        }
+
+        ringSize = max(params.sq_off.array + params.sq_entries * sizeof(u_int32), params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+        ring = mmap(NULL, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+
+        if (ring == MAP_FAILED){
+            ring = NULL;
+            releaseUring();
+            return false;
+        }
+
+        sqeSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe*)mmap(NULL, sqeSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+
+        if (sqes == MAP_FAILED){
+            sqes = NULL;
+            releaseUring();
+            return false;
+        }
+
+        char* ptr = (char*)(ring);
+
+        sqHead = (u_int32*)(ptr + params.sq_off.head);
+        sqMask = *(u_int32*)(ptr + params.sq_off.ring_mask);
+        sqArray = (u_int32*)(ptr + params.sq_off.array);
+        sqTailPtr = (u_int32*)(ptr + params.sq_off.tail);
+        sqEntries = params.sq_entries;
+        sqTail = *sqTailPtr;
+        cqHead = (u_int32*)(ptr + params.cq_off.head);
+        cqTail = (u_int32*)(ptr + params.cq_off.tail);
+        cqMask = *(u_int32*)(ptr + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(ptr + params.cq_off.cqes);
+
+        if (multishot && !initBufferRing()){
+            multishot = false;
+        }
+
+        // 不使用multishot时把各连接的接收缓冲区注册为固定缓冲区,注册失败(如超过锁定内存限制)时使用普通recv
+        if (!multishot){
+            vector<iovec> vec(maxConn);
+
+            for (int i = 0; i < maxConn; i++){
+                vec[i].iov_base = mem + (size_t)(i) * bufSize;
+                vec[i].iov_len = bufSize;
+            }
+
+            fixed = uringRegister(IORING_REGISTER_BUFFERS, &vec[0], maxConn) == 0;
+        }
+
+        armEvent();
+
+        return true;
+    }
+
+    // 检查需要的操作是否都被内核支持
+    bool probe(){
+        const int count = 256;
+        vector<char> buf(sizeof(io_uring_probe) + count * sizeof(io_uring_probe_op), 0);
+        io_uring_probe* res = (io_uring_probe*)(&buf[0]);
+        const int ops[] = {IORING_OP_SEND, IORING_OP_RECV, IORING_OP_READ, IORING_OP_READ_FIXED};
+
+        if (uringRegister(IORING_REGISTER_PROBE, res, count) < 0){
+            return false;
+        }
+
+        for (int op : ops){
+            if (op > res->last_op || !(res->ops[op].flags & IO_URING_OP_SUPPORTED)){
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // 注册multishot recv使用的缓冲区环(5.19+)
+    bool initBufferRing(){
+        io_uring_buf_reg reg;
+
+        pbufRingSize = PBUF_COUNT * sizeof(io_uring_buf);
+        pbufRing = (io_uring_buf*)mmap(NULL, pbufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (pbufRing == MAP_FAILED){
+            pbufRing = NULL;
+            return false;
+        }
+
+        pbufMem = (char*)mmap(NULL, (size_t)(PBUF_COUNT) * PBUF_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (pbufMem == MAP_FAILED){
+            pbufMem = NULL;
+            return false;
+        }
+
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = (u_int64)(pbufRing);
+        reg.ring_entries = PBUF_COUNT;
+        reg.bgid = 0;
+
+        if (uringRegister(IORING_REGISTER_PBUF_RING, &reg, 1) < 0){
+            return false;
+        }
+
+        pbufTail = 0;
+        for (int i = 0; i < PBUF_COUNT; i++){
+            recycle(i);
+        }
+        publish();
+
+        return true;
+    }
+
+    // 归还multishot recv的缓冲区
+    void recycle(int bid){
+        io_uring_buf* buf = &pbufRing[pbufTail & (PBUF_COUNT - 1)];
+
+        buf->addr = (u_int64)(pbufMem + (size_t)(bid) * PBUF_SIZE);
+        buf->len = PBUF_SIZE;
+        buf->bid = bid;
+        pbufTail++;
+    }
+
+    // 缓冲区环的tail与第一个缓冲区的resv字段重叠
+    void publish(){
+        __atomic_store_n(&pbufRing[0].resv, pbufTail, __ATOMIC_RELEASE);
+    }
+
+    io_uring_sqe* getSqe(){
+        if (sqTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries){
+            enter(0, 0);
+            if (sqTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries){
+                return NULL;
+            }
+        }
+
+        u_int32 idx = sqTail & sqMask;
+        io_uring_sqe* sqe = &sqes[idx];
+
+        memset(sqe, 0, sizeof(io_uring_sqe));
+        sqArray[idx] = idx;
+        sqTail++;
+
+        return sqe;
+    }
+
+    // 提交所有新的操作,wait大于0时最多等待timeout毫秒
+    void enter(u_int32 wait, int timeout){
+        u_int32 submit = sqTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+
+        __atomic_store_n(sqTailPtr, sqTail, __ATOMIC_RELEASE);
+
+        if (wait == 0){
+            if (submit > 0) uringEnter(submit, 0, 0, NULL, 0);
+            return;
+        }
+
+        __kernel_timespec ts;
+        io_uring_getevents_arg arg;
+
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000LL;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (u_int64)(&ts);
+
+        uringEnter(submit, wait, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    }
+
+    // 处理已完成的操作,没有已完成的操作时提交新的操作并最多等待timeout毫秒
+    void waitUring(int timeout){
+        if (reap() == 0){
+            enter(1, timeout);
+            reap();
+        } else if (sqTail != __atomic_load_n(sqHead, __ATOMIC_ACQUIRE)){
+            enter(0, 0);
+        }
+    }
+
+    // 处理已完成的操作,返回处理的个数
+    int reap(){
+        int num = 0;
+        u_int32 head = *cqHead;
+
+        while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)){
+            io_uring_cqe* cqe = &cqes[head & cqMask];
+            u_int64 tag = cqe->user_data;
+            int res = cqe->res;
+            u_int32 flags = cqe->flags;
+
+            __atomic_store_n(cqHead, ++head, __ATOMIC_RELEASE);
+            complete(tag, res, flags);
+            num++;
+        }
+
+        if (multishot && num > 0){
+            publish();
+        }
+
+        return num;
+    }
+
+    void complete(u_int64 tag, int res, u_int32 flags){
+        int op = tag & 0xFF;
+
+        if (op == OP_EVENT){
+            armEvent();
+            return;
+        }
+
+        Channel* ch = slots[tag >> 32];
+        bool live = ch && ch->state == Channel::LIVE && Tag(ch->slot, ch->gen, op) == tag;
+
+        if (op == OP_SEND){
+            if (ch == NULL) return;
+            ch->ops--;
+            ch->sending = false;
+
+            if (!live){
+                return;
+            }
+            if (res < 0){
+                disconnect(ch, RedisConnect::NETERR);
+                return;
+            }
+
+            ch->sendPos += res;
+
+            if (ch->sendPos < ch->sendBuf.size()){
+                submitSend(ch);
+            } else{
+                trySend(ch);
+            }
+            return;
+        }
+
+        const char* src = NULL;
+
+        if (flags & IORING_CQE_F_BUFFER){
+            src = pbufMem + (size_t)(flags >> IORING_CQE_BUFFER_SHIFT) * PBUF_SIZE;
+        }
+
+        if (ch && !(flags & IORING_CQE_F_MORE)){
+            ch->ops--;
+            ch->recving = false;
+        }
+
+        if (live){
+            if (res > 0){
+                ++stat.recvCount;
+
+                if (src == NULL){
+                    ch->readed += res;
+                    deliver(ch);
+                } else if (res > bufSize - 1 - ch->readed){
+                    disconnect(ch, RedisConnect::PARAMERR);
+                } else{
+                    memcpy(ch->data + ch->readed, src, res);
+                    ch->readed += res;
+                    deliver(ch);
+                }
+            } else if (res == 0){
+                disconnect(ch, RedisConnect::NETCLOSE);
+            } else if (res == -EINVAL && multishot){
+                // 内核不支持multishot recv,改用普通recv
+                multishot = false;
+            } else if (res != -ENOBUFS){
+                disconnect(ch, RedisConnect::NETERR);
+            }
+
+            if (ch->state == Channel::LIVE && !ch->recving){
+                armRecv(ch);
+            }
+        }
+
+        if (src){
+            recycle(flags >> IORING_CQE_BUFFER_SHIFT);
+        }
+    }
+
+    void armEvent(){
+        io_uring_sqe* sqe = getSqe();
+
+        if (sqe == NULL){
+            return;
+        }
+
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = efd;
+        sqe->addr = (u_int64)(&evbuf);
+        sqe->len = sizeof(evbuf);
+        sqe->user_data = Tag(0, 0, OP_EVENT);
+    }
+
+    void armRecv(Channel* ch){
+        io_uring_sqe* sqe = getSqe();
+
+        if (sqe == NULL){
+            disconnect(ch, RedisConnect::SYSERR);
+            return;
+        }
+
+        sqe->fd = ch->sock;
+        sqe->user_data = Tag(ch->slot, ch->gen, OP_RECV);
+
+        if (multishot){
+            sqe->opcode = IORING_OP_RECV;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = 0;
+        } else{
+            sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_RECV;
+            sqe->addr = (u_int64)(ch->data + ch->readed);
+            sqe->len = bufSize - 1 - ch->readed;
+            sqe->buf_index = fixed ? ch->slot : 0;
+        }
+
+        ch->ops++;
+        ch->recving = true;
+    }
+
+    void submitSend(Channel* ch){
+        io_uring_sqe* sqe = getSqe();
+
+        if (sqe == NULL){
+            disconnect(ch, RedisConnect::SYSERR);
+            return;
+        }
+
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = ch->sock;
+        sqe->addr = (u_int64)(ch->sendBuf.data() + ch->sendPos);
+        sqe->len = ch->sendBuf.size() - ch->sendPos;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = Tag(ch->slot, ch->gen, OP_SEND);
+
+        ch->ops++;
+        ch->sending = true;
+        ++stat.sendCount;
+    }
+
+    void releaseUring(){
+        if (sqes){
+            munmap(sqes, sqeSize);
+            sqes = NULL;
+        }
+        if (ring){
+            munmap(ring, ringSize);
+            ring = NULL;
+        }
+        if (ringFd >= 0){
+            ::close(ringFd);
+            ringFd = -1;
+        }
+        if (pbufRing){
+            munmap(pbufRing, pbufRingSize);
+            pbufRing = NULL;
+        }
+        if (pbufMem){
+            munmap(pbufMem, (size_t)(PBUF_COUNT) * PBUF_SIZE);
+            pbufMem = NULL;
+        }
+        fixed = false;
+    }
+#else
+protected:
+    // 没有编译io_uring后端,start时使用epoll
+    bool initUring(){
+        return false;
+    }
+
+    void waitUring(int){
+    }
+
+    void armRecv(Channel*){
+    }
+
+    void submitSend(Channel*){
+    }
+
+    void releaseUring(){
+    }
+#endif
+
+    void release(){
+        releaseUring();
+
+        if (epfd >= 0){
+            ::close(epfd);
+            epfd = -1;
+        }
+        if (efd >= 0){
+            ::close(efd);
+            efd = -1;
+        }
+        if (mem){
+            munmap(mem, memSize);
+            mem = NULL;
+        }
+    }
+
+protected:
+    Backend backend = AUTO;
+    int maxConn = 0;
+    int bufSize = 0;
+    bool multishot = false;
+    bool fixed = false;      // 接收缓冲区是否已注册为固定缓冲区
+
+    atomic<bool> running{false};
+    thread worker;
+    thread connector;          // 重连线程
+    Stat stat;
+
+    // 以下成员由mtx保护
+    mutex mtx;
+    condition_variable cv;
+    condition_variable connCv; // 唤醒重连线程
+    bool signaled = false;     // 已写eventfd,事件循环尚未处理
+    vector<bool> used;         // 已分配的位置
+    vector<Channel*> attaching;
+    vector<Channel*> detaching;
+    vector<Channel*> pending;
+    vector<Channel*> connecting;                  // 等待重连的连接
+    vector<pair<Channel*, SOCKET>> reconnected;   // 重连结果
+
+    // 以下成员只在事件循环线程中访问
+    vector<Channel*> slots;
+    vector<Channel*> attachList;
+    vector<Channel*> detachList;
+    vector<Channel*> notifyList;
+    vector<pair<Channel*, SOCKET>> reconnectList;
+    char* mem = NULL;          // 所有连接的接收缓冲区
+    size_t memSize = 0;
+    int efd = -1;              // 唤醒事件循环的eventfd
+    u_int64 evbuf = 0;
+
+    int epfd = -1;
+    vector<epoll_event> events;
+
+#ifdef REDIS_IO_URING
+    int ringFd = -1;
+    void* ring = NULL;
+    size_t ringSize = 0;
+    io_uring_sqe* sqes = NULL;
+    size_t sqeSize = 0;
+    u_int32* sqHead = NULL;
+    u_int32* sqTailPtr = NULL;
+    u_int32* sqArray = NULL;
+    u_int32 sqMask = 0;
+    u_int32 sqEntries = 0;
+    u_int32 sqTail = 0;        // 本地的sq tail,enter时写回内核
+    u_int32* cqHead = NULL;
+    u_int32* cqTail = NULL;
+    u_int32 cqMask = 0;
+    io_uring_cqe* cqes = NULL;
+
+    io_uring_buf* pbufRing = NULL;
+    size_t pbufRingSize = 0;
+    char* pbufMem = NULL;
+    u_int16 pbufTail = 0;
+#endif
+};
+
+#endif
@@ -0,0 +1,523 @@
+#ifndef REDIS_MUX
+#define REDIS_MUX
+#include <deque>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <semaphore.h>
+#include "RedisConn.h"
+#include "RedisIoLoop.h"
+
+using namespace std;
+
+// 多路复用连接(自动pipeline):多个线程通过无锁提交队列提交命令,写线程把队列中
+// 积累的所有命令合并为一次send发送,读线程按顺序解析回复并唤醒对应的调用者.
+// getConnect返回的RedisConnect与普通连接用法相同(execute/get/set等),但共享同一条连接,
+// 因此不要在上面执行阻塞命令(BLPOP等)或依赖连接状态的命令(WATCH、SELECT等).
+// 调用者最多等待每次调用的timeout毫秒,超时返回TIMEOUT,回复到达后被丢弃,连接不受影响;
+// 连接上的请求超过connect时的timeout仍没有任何回复时认为连接异常,所有未完成的请求失败后重连.
+// connect时指定RedisIoLoop则不创建读写线程,由事件循环与其它连接一起批量收发
+class RedisMultiplexer : public RedisConnect::Executor, public RedisIoLoop::Channel, public enable_shared_from_this<RedisMultiplexer>{
+public:
+    // 统计信息
+    struct Stat{
+        atomic<int64> batchCount;    // send的次数
+        atomic<int64> requestCount;  // 提交的请求数
+        atomic<int64> errorCount;    // 因网络错误失败的请求数
+        atomic<int64> timeoutCount;  // 调用者等待超时放弃的请求数
+
+        Stat(): batchCount(0), requestCount(0), errorCount(0), timeoutCount(0){}
+
+        // 平均每次send合并的请求数
+        double getBatchSize() const{
+            return batchCount > 0 ? (double)(requestCount) / batchCount : 0;
+        }
+    };
+
+protected:
+    // 请求的状态
+    enum{
+        WAITING = 0,   // 等待发送或等待回复
+        BUSY = 1,      // 写线程正在复制请求数据或读线程正在调用func,调用者不能放弃
+        DONE = 2,      // 已完成,调用者会被sem唤醒
+        ABANDONED = 3  // 调用者已经超时返回,不能再访问data与func,请求结束时由多路复用连接释放
+    };
+
+    // 一次提交的请求,每个调用者线程复用同一个对象,完成后通过sem唤醒调用者;
+    // 调用者超时放弃后对象交给多路复用连接,线程下一次调用时重新分配
+    struct Request{
+        const string* data;
+        int count;
+        int done;
+        int code;
+        const function<void(const char*, const char*)>* func;
+        Request* next;
+        atomic<int> state;
+        sem_t sem;
+
+        Request(): data(NULL), count(0), done(0), code(0), func(NULL), next(NULL), state(WAITING){
+            sem_init(&sem, 0, 0);
+        }
+
+        ~Request(){
+            sem_destroy(&sem);
+        }
+    };
+
+public:
+    RedisMultiplexer(): running(false), connected(false), broken(false), head(NULL){
+        sem_init(&wsem, 0, 0);
+    }
+
+    ~RedisMultiplexer(){
+        close();
+        sem_destroy(&wsem);
+    }
+
+    // 建立连接并启动读写线程,指定loop时加入事件循环(接收缓冲区大小由事件循环决定)
+    bool connect(const string& host, int port, const string& passwd = "", int timeout = 3000, int memsz = 2 * 1024 * 1024,
+                 const shared_ptr<RedisIoLoop>& loop = nullptr){
+        close();
+
+        if (!conn.connectRedis(host, port, timeout, memsz) || conn.auth(passwd) < 0){
+            return false;
+        }
+
+        this->timeout = timeout;
+        this->loop = loop;
+        running = true;
+        connected = true;
+        broken = false;
+
+        if (loop){
+            if (!loop->attach(this, conn.getSocket(), timeout)){
+                running = false;
+                this->loop = nullptr;
+                conn.closeConnect();
+                return false;
+            }
+            return true;
+        }
+
+        buffer.resize(memsz + 1);
+        writer = thread([this](){ writeLoop(); });
+        reader = thread([this](){ readLoop(); });
+
+        return true;
+    }
+
+    // 停止读写线程,未完成的请求返回NETERR
+    void close(){
+        if (!running){
+            return;
+        }
+
+        running = false;
+
+        if (loop){
+            loop->detach(this);
+            loop = nullptr;
+        } else{
+            sem_post(&wsem);
+            if (writer.joinable()) writer.join();
+            if (reader.joinable()) reader.join();
+        }
+
+        fail(RedisConnect::NETERR);
+        drop(RedisConnect::NETERR);
+        conn.closeConnect();
+    }
+
+    // 获取一个使用当前多路复用连接的RedisConnect对象(对象本身很轻,可以每个线程一个)
+    shared_ptr<RedisConnect> getConnect(){
+        shared_ptr<RedisConnect> redis = make_shared<RedisConnect>();
+        redis->setExecutor(shared_from_this(), timeout);
+        return redis;
+    }
+
+    bool isConnected() const{
+        return connected && !broken;
+    }
+
+    const Stat& getStat() const{
+        return stat;
+    }
+
+    // 提交请求并等待回复,timeout为本次调用最多等待的毫秒数(小于等于0时一直等待)
+    int execute(const string& data, int count, const function<void(const char*, const char*)>& func, int timeout){
+        static thread_local unique_ptr<Request> cache;
+
+        if (!running){
+            return RedisConnect::NETERR;
+        }
+
+        if (!cache){
+            cache.reset(new Request());
+        }
+
+        Request* req = cache.get();
+
+        req->data = &data;
+        req->count = count;
+        req->done = 0;
+        req->code = RedisConnect::OK;
+        req->func = &func;
+        req->state = WAITING;
+
+        // 无锁入栈,栈原来为空时唤醒写线程
+        Request* prev = head.load(memory_order_relaxed);
+        do{
+            req->next = prev;
+        } while (!head.compare_exchange_weak(prev, req, memory_order_release, memory_order_relaxed));
+
+        if (prev == NULL){
+            if (loop){
+                loop->notify(this);
+            } else{
+                sem_post(&wsem);
+            }
+        }
+
+        if (wait(req, timeout)){
+            return req->code;
+        }
+
+        // 请求仍在提交栈或等待回复的队列中,由多路复用连接在请求结束时释放
+        cache.release();
+        ++stat.timeoutCount;
+
+        return RedisConnect::TIMEOUT;
+    }
+
+protected:
+    // 等待请求完成,超时并且成功放弃请求时返回false
+    bool wait(Request* req, int timeout){
+        if (timeout > 0){
+            struct timespec ts;
+
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += timeout / 1000;
+            ts.tv_nsec += (timeout % 1000) * 1000000L;
+
+            if (ts.tv_nsec >= 1000000000L){
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+
+            while (true){
+                if (sem_timedwait(&req->sem, &ts) == 0){
+                    return true;
+                }
+
+                if (errno == EINTR){
+                    continue;
+                }
+
+                int state = WAITING;
+
+                if (req->state.compare_exchange_strong(state, ABANDONED)){
+                    return false;
+                }
+
+                // 已经完成,sem_post马上就会到达
+                if (state == DONE){
+                    break;
+                }
+
+                // 写线程或读线程正在使用请求的数据,很快会恢复为WAITING或DONE
+                this_thread::yield();
+            }
+        }
+
+        while (sem_wait(&req->sem) < 0 && errno == EINTR){
+        }
+
+        return true;
+    }
+
+    // 请求结束:唤醒等待的调用者,调用者已经放弃时释放请求
+    void complete(Request* req, int code){
+        if (req->state.exchange(DONE) == ABANDONED){
+            delete req;
+            return;
+        }
+
+        req->code = code;
+        sem_post(&req->sem);
+    }
+
+    // 取出提交栈中的所有请求,按提交顺序追加到data并加入等待回复的队列,返回请求数
+    int collect(string& data){
+        Request* list = head.exchange(NULL, memory_order_acquire);
+
+        if (list == NULL){
+            return 0;
+        }
+
+        batch.clear();
+        for (Request* req = list; req; req = req->next){
+            batch.push_back(req);
+        }
+        reverse(batch.begin(), batch.end());
+
+        size_t num = 0;
+
+        for (Request* req : batch){
+            int state = WAITING;
+
+            // 调用者已经放弃的请求不再发送
+            if (!req->state.compare_exchange_strong(state, BUSY)){
+                delete req;
+                continue;
+            }
+
+            data += *req->data;
+            req->state = WAITING;
+            batch[num++] = req;
+        }
+
+        batch.resize(num);
+
+        if (num == 0){
+            return 0;
+        }
+
+        {
+            lock_guard<mutex> qlk(queMtx);
+            for (Request* req : batch) inflight.push_back(req);
+        }
+
+        ++stat.batchCount;
+        stat.requestCount += batch.size();
+
+        return batch.size();
+    }
+
+    // 让提交栈中尚未发送的请求失败
+    void drop(int code){
+        for (Request* req = head.exchange(NULL, memory_order_acquire); req; ){
+            Request* next = req->next;
+            ++stat.errorCount;
+            complete(req, code);
+            req = next;
+        }
+    }
+
+    // 写线程:把提交栈中积累的请求合并后一次发送
+    void writeLoop(){
+        string data;
+
+        while (running){
+            while (sem_wait(&wsem) < 0 && errno == EINTR){
+            }
+
+            lock_guard<mutex> lk(sendMtx);
+
+            if (!connected || broken){
+                drop(RedisConnect::NETERR);
+                continue;
+            }
+
+            data.clear();
+
+            if (collect(data) == 0){
+                continue;
+            }
+
+            // 发送失败时由读线程负责让已发送的请求失败并重连
+            if (conn.write(data.c_str(), data.size()) < 0){
+                broken = true;
+            }
+        }
+    }
+
+    // 让所有已发送但未收到回复的请求失败
+    void fail(int code){
+        lock_guard<mutex> qlk(queMtx);
+        stat.errorCount += inflight.size();
+        for (Request* req : inflight){
+            complete(req, code);
+        }
+        inflight.clear();
+    }
+
+    // 连接异常:回复与请求已经无法对应,让所有未完成的请求失败后重连
+    void reset(int code){
+        {
+            lock_guard<mutex> lk(sendMtx);
+            connected = false;
+            fail(code);
+            conn.closeConnect();
+        }
+
+        while (running){
+            if (conn.reconnect()){
+                lock_guard<mutex> lk(sendMtx);
+                broken = false;
+                connected = true;
+                break;
+            }
+            Sleep(100);
+        }
+    }
+
+    // 按顺序把完整的回复交给等待的请求,返回已处理的字节数,数据错误时返回错误码
+    int dispatch(const char* data, int len){
+        int pos = 0;
+
+        while (pos < len){
+            const char* end = NULL;
+            Request* req = NULL;
+
+            {
+                lock_guard<mutex> qlk(queMtx);
+                if (inflight.size() > 0) req = inflight.front();
+            }
+
+            // 没有等待回复的请求却收到了数据,说明协议错乱
+            if (req == NULL){
+                return RedisConnect::DATAERR;
+            }
+
+            int code = RedisConnect::ParseReply(data + pos, data + len, end, NULL);
+
+            if (code == RedisConnect::TIMEOUT){
+                break;
+            }
+            if (code < 0){
+                return code;
+            }
+
+            int state = WAITING;
+            bool live = req->state.compare_exchange_strong(state, BUSY);
+
+            // 调用者已经放弃的请求只跳过回复
+            if (live){
+                (*req->func)(data + pos, end);
+            }
+
+            pos = end - data;
+
+            if (++req->done >= req->count){
+                {
+                    lock_guard<mutex> qlk(queMtx);
+                    inflight.pop_front();
+                }
+                complete(req, RedisConnect::OK);
+            } else if (live){
+                req->state = WAITING;
+            }
+        }
+
+        return pos;
+    }
+
+    // 读线程:解析回复并按顺序交给对应的请求
+    void readLoop(){
+        int len = 0;
+        int readed = 0;
+        char* dest = &buffer[0];
+        const int memsz = buffer.size() - 1;
+        int64 last = RedisConnect::GetMillisecond();
+
+        while (running){
+            if (broken){
+                reset(RedisConnect::NETERR);
+                readed = 0;
+                continue;
+            }
+
+            if (readed >= memsz){
+                reset(RedisConnect::PARAMERR);
+                readed = 0;
+                continue;
+            }
+
+            if ((len = conn.read(dest + readed, memsz - readed, false)) > 0){
+                dest[readed += len] = 0;
+                last = RedisConnect::GetMillisecond();
+
+                if ((len = dispatch(dest, readed)) < 0){
+                    reset(len);
+                    readed = 0;
+                } else if (len > 0){
+                    memmove(dest, dest + len, readed - len);
+                    readed -= len;
+                }
+                continue;
+            }
+
+            if (len != RedisConnect::TIMEOUT){
+                reset(len);
+                readed = 0;
+                continue;
+            }
+
+            int64 now = RedisConnect::GetMillisecond();
+
+            if (!isWaiting()){
+                last = now;
+            } else if (now - last > timeout){
+                reset(RedisConnect::TIMEOUT);
+                readed = 0;
+                last = now;
+            }
+        }
+    }
+
+// 事件循环的回调
+protected:
+    int onSend(string& data){
+        // 事件循环只在连接正常(包括重连成功)后调用onSend
+        connected = true;
+        return collect(data);
+    }
+
+    int onRecv(const char* data, int len){
+        return dispatch(data, len);
+    }
+
+    void onError(int code){
+        connected = false;
+        fail(code);
+        drop(RedisConnect::NETERR);
+    }
+
+    // 在事件循环的重连线程中调用,connected由onSend设置,避免与同时调用的onError交错
+    SOCKET onReconnect(){
+        if (!running || !conn.reconnect()){
+            return INVALID_SOCKET;
+        }
+        return conn.getSocket();
+    }
+
+    bool isWaiting(){
+        lock_guard<mutex> qlk(queMtx);
+        return inflight.size() > 0;
+    }
+
+protected:
+    RedisConnect conn;  // 实际的网络连接
+    int timeout = 3000;
+    vector<char> buffer;  // 读线程的接收缓冲区
+
+    atomic<bool> running;
+    atomic<bool> connected;
+    atomic<bool> broken;  // 写线程发送失败,等待读线程处理
+
+    atomic<Request*> head;  // 无锁提交栈
+    sem_t wsem;  // 唤醒写线程
+
+    mutex sendMtx;  // 保护发送与重连
+    mutex queMtx;   // 保护inflight
+    deque<Request*> inflight;  // 已发送、等待回复的请求(按发送顺序)
+
+    thread writer;
+    thread reader;
+    vector<Request*> batch;  // collect使用的临时数组
+    shared_ptr<RedisIoLoop> loop;  // 驱动当前连接的事件循环,为空时使用读写线程
+    Stat stat;
+};
+
+#endif
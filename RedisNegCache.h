@@ -0,0 +1,276 @@
+#ifndef REDIS_NEG_CACHE
+#define REDIS_NEG_CACHE
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include "typedef.h"
+
+using namespace std;
+
+// 未命中缓存:记住最近一段时间内GET key、HGET key field返回nil的结果,ttl毫秒内再次查询时直接返回NOTFOUND,
+// 省去一次网络往返.只保存键与字段的64位哈希,按键的哈希分组(每组WAYS项),容量固定,组满时替换最早过期的项.
+// 本客户端执行写命令后使涉及的键失效;开启服务端失效通知(CLIENT TRACKING,见RedisConnPool::SetNegCache)后
+// 其它客户端修改键时也会失效.任何情况下缓存的结果最多过期ttl毫秒
+class RedisNegCache{
+public:
+    static const int WAYS = 8;  // 每组的项数
+    static const int LOCKS = 64;  // 锁的个数,每把锁保护若干个组
+
+    struct Stat{
+        atomic<int64> lookups;        // 可以缓存的读命令数
+        atomic<int64> hits;           // 直接返回NOTFOUND的次数
+        atomic<int64> inserts;        // 缓存的未命中结果数
+        atomic<int64> invalidations;  // 使键失效的次数
+        atomic<int64> evictions;      // 因组满被替换的未过期项数
+
+        Stat(): lookups(0), hits(0), inserts(0), invalidations(0), evictions(0){}
+
+        // 读命令被缓存短路的比例
+        double getHitRate() const{
+            return lookups > 0 ? (double)(hits) / lookups : 0;
+        }
+    };
+
+protected:
+    struct Entry{
+        u_int64 key;    // 键的哈希,0表示空
+        u_int64 field;  // 字段的哈希,GET为0
+        int64 expire;   // 过期时间(毫秒)
+    };
+
+public:
+    // capacity为最多缓存的项数(向上取整为WAYS乘以2的幂),ttl为缓存时间(毫秒)
+    RedisNegCache(int capacity = 65536, int ttl = 1000): ttl(max(ttl, 1)), trackingId(0){
+        int size = 64;
+        while (size * WAYS < capacity) size <<= 1;
+        mask = size - 1;
+        entries = vector<Entry>(size * WAYS);
+        versions = vector<u_int32>(size, 1);
+        for (auto& item : entries){
+            item.key = 0;
+            item.expire = 0;
+        }
+    }
+
+    // 是否为可以缓存未命中结果的读命令(GET key、HGET key field)
+    static bool IsCacheable(const vector<string>& args){
+        if (args.size() == 2) return strcasecmp(args[0].c_str(), "get") == 0;
+        if (args.size() == 3) return strcasecmp(args[0].c_str(), "hget") == 0;
+        return false;
+    }
+
+    // 查询args(需要是IsCacheable的命令)是否缓存了未命中结果,命中时返回true.
+    // 没有命中时version返回所在组的版本,执行命令后用insert缓存未命中结果;version为0表示不能缓存
+    bool lookup(const vector<string>& args, u_int32& version){
+        u_int64 key = Hash(args[1]);
+        u_int64 field = args.size() > 2 ? Hash(args[2]) : 0;
+        u_int32 idx = (u_int32)(key) & mask;
+        int64 now = GetMillisecond();
+
+        version = 0;
+
+        if (trackingId < 0){
+            return false;
+        }
+
+        ++stat.lookups;
+
+        lock_guard<mutex> lk(locks[idx % LOCKS]);
+        Entry* group = &entries[idx * WAYS];
+
+        for (int i = 0; i < WAYS; i++){
+            if (group[i].key == key && group[i].field == field && group[i].expire > now){
+                ++stat.hits;
+                return true;
+            }
+        }
+
+        version = versions[idx];
+
+        return false;
+    }
+
+    // 缓存未命中结果,lookup之后组内有键失效过(version不同)时不缓存,避免覆盖并发写入的结果
+    void insert(const vector<string>& args, u_int32 version){
+        u_int64 key = Hash(args[1]);
+        u_int64 field = args.size() > 2 ? Hash(args[2]) : 0;
+        u_int32 idx = (u_int32)(key) & mask;
+        int64 now = GetMillisecond();
+        int pos = -1;
+
+        lock_guard<mutex> lk(locks[idx % LOCKS]);
+        Entry* group = &entries[idx * WAYS];
+
+        if (version != versions[idx] || trackingId < 0){
+            return;
+        }
+
+        // 优先使用同一项,其次是空项,都没有时替换最早过期的项
+        for (int i = 0; i < WAYS && pos < 0; i++){
+            if (group[i].key == key && group[i].field == field) pos = i;
+        }
+        for (int i = 0; i < WAYS && pos < 0; i++){
+            if (group[i].key == 0) pos = i;
+        }
+        if (pos < 0){
+            pos = 0;
+            for (int i = 1; i < WAYS; i++){
+                if (group[i].expire < group[pos].expire) pos = i;
+            }
+            if (group[pos].expire > now) ++stat.evictions;
+        }
+
+        group[pos].key = key;
+        group[pos].field = field;
+        group[pos].expire = now + ttl;
+
+        ++stat.inserts;
+    }
+
+    // 写命令执行后使命令中的键失效(args[0]为命令名称),只读命令与没有键的命令直接忽略
+    void invalidate(const vector<string>& args){
+        if (args.empty()){
+            return;
+        }
+
+        char name[32];
+        const string& cmd = args[0];
+        int len = min((int)(cmd.size()), (int)(sizeof(name)) - 1);
+
+        for (int i = 0; i < len; i++){
+            name[i] = tolower(cmd[i]);
+        }
+        name[len] = 0;
+
+        if (strcmp(name, "flushdb") == 0 || strcmp(name, "flushall") == 0){
+            clear();
+        } else if (args.size() < 2 || IsReadOnly(name)){
+            return;
+        } else if (strcmp(name, "del") == 0 || strcmp(name, "unlink") == 0){
+            for (size_t i = 1; i < args.size(); i++) invalidate(args[i]);
+        } else if (strcmp(name, "mset") == 0 || strcmp(name, "msetnx") == 0){
+            for (size_t i = 1; i < args.size(); i += 2) invalidate(args[i]);
+        } else if (strcmp(name, "eval") == 0 || strcmp(name, "evalsha") == 0){
+            size_t num = args.size() > 2 ? atoi(args[2].c_str()) : 0;
+            for (size_t i = 3; i < args.size() && i < num + 3; i++) invalidate(args[i]);
+        } else if (IsTwoKey(name)){
+            invalidate(args[1]);
+            if (args.size() > 2) invalidate(args[2]);
+        } else{
+            invalidate(args[1]);
+        }
+    }
+
+    // 使一个键(包括它的所有字段)失效
+    void invalidate(const string& key){
+        u_int64 hash = Hash(key);
+        u_int32 idx = (u_int32)(hash) & mask;
+
+        ++stat.invalidations;
+
+        lock_guard<mutex> lk(locks[idx % LOCKS]);
+        Entry* group = &entries[idx * WAYS];
+
+        versions[idx]++;
+
+        for (int i = 0; i < WAYS; i++){
+            if (group[i].key == hash) group[i].key = 0;
+        }
+    }
+
+    // 清空所有缓存(如FLUSHALL或失效通知连接断开时)
+    void clear(){
+        for (int i = 0; i < LOCKS; i++){
+            lock_guard<mutex> lk(locks[i]);
+            for (size_t idx = i; idx < versions.size(); idx += LOCKS){
+                versions[idx]++;
+                for (int j = 0; j < WAYS; j++) entries[idx * WAYS + j].key = 0;
+            }
+        }
+    }
+
+    // 设置服务端失效通知:id为订阅__redis__:invalidate的连接ID(0表示不使用失效通知,
+    // 小于0表示需要失效通知但订阅连接不可用,此时不再查询和缓存),host与port为订阅连接所在的节点
+    void setTracking(const string& host, int port, int64 id){
+        lock_guard<mutex> lk(mtx);
+        trackingHost = host;
+        trackingPort = port;
+        trackingId = id;
+    }
+
+    // 连接(host, port)需要重定向失效通知的目标连接ID,0表示不需要;返回-1表示该连接读到的未命中不能缓存
+    int64 getTrackingId(const string& host, int port){
+        int64 id = trackingId;
+
+        if (id <= 0){
+            return id;
+        }
+
+        lock_guard<mutex> lk(mtx);
+
+        return host == trackingHost && port == trackingPort ? trackingId.load() : -1;
+    }
+
+    int getTimeout() const{
+        return ttl;
+    }
+
+    const Stat& getStat() const{
+        return stat;
+    }
+
+protected:
+    static int64 GetMillisecond(){
+        return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static u_int64 Hash(const string& str){
+        u_int64 h = 14695981039346656037ULL;
+        for (size_t i = 0; i < str.size(); i++){
+            h ^= (u_char)(str[i]);
+            h *= 1099511628211ULL;
+        }
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return h | 1;  // 0表示空项
+    }
+
+    static bool IsReadOnly(const char* name){
+        static const char* names[] = {"get", "mget", "hget", "hmget", "hgetall", "exists", "ttl", "pttl", "type", "strlen",
+                                      "lrange", "llen", "smembers", "sismember", "scard", "zrange", "zrangebyscore",
+                                      "zrevrangebyscore", "zscore", "zcard", "scan", "keys", "auth", "select", "ping",
+                                      "client", "info", "subscribe", "watch", "multi", "exec", "discard", "unwatch"};
+        for (const char* item : names){
+            if (strcmp(name, item) == 0) return true;
+        }
+        return false;
+    }
+
+    // 前两个参数都是被修改的键的命令
+    static bool IsTwoKey(const char* name){
+        static const char* names[] = {"rename", "renamenx", "copy", "smove", "lmove", "rpoplpush", "blmove", "brpoplpush"};
+        for (const char* item : names){
+            if (strcmp(name, item) == 0) return true;
+        }
+        return false;
+    }
+
+protected:
+    int ttl;
+    u_int32 mask;
+    vector<Entry> entries;  // 每组WAYS项
+    vector<u_int32> versions;  // 每组的版本,组内有键失效时加一
+    mutex locks[LOCKS];
+    mutex mtx;  // 保护trackingHost与trackingPort
+    string trackingHost;
+    int trackingPort = 0;
+    atomic<int64> trackingId;
+    Stat stat;
+};
+
+#endif
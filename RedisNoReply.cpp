@@ -0,0 +1,223 @@
+#include "RedisNoReply.h"
+
+static const string REPLY_ON = "*3\r\n$6\r\nclient\r\n$5\r\nreply\r\n$2\r\non\r\n";
+static const string REPLY_OFF = "*3\r\n$6\r\nclient\r\n$5\r\nreply\r\n$3\r\noff\r\n";
+
+RedisNoReply::RedisNoReply() : port_(0), maxBuffer_(4 * 1024 * 1024), wait_(100), interval_(1000),
+    timeout_(3000), running_(false) {
+}
+
+RedisNoReply::~RedisNoReply() {
+    Stop();
+}
+
+bool RedisNoReply::Start(const string& host, int port, const string& pwd, int conns,
+                         int maxBuffer, int wait, int interval, int timeout) {
+    if(running_ || conns <= 0 || maxBuffer <= 0 || interval <= 0){
+        return false;
+    }
+    host_ = host;
+    port_ = port;
+    passwd_ = pwd;
+    maxBuffer_ = maxBuffer;
+    wait_ = wait;
+    interval_ = interval;
+    timeout_ = timeout;
+    lanes_.clear();
+    running_ = true;
+    for(int i = 0; i < conns; ++i){
+        shared_ptr<Lane> lane = make_shared<Lane>();
+        Connect(*lane);
+        lanes_.push_back(lane);
+    }
+    for(const auto& item : lanes_){
+        Lane* lane = item.get();
+        lane->worker = std::thread([this, lane](){
+            Run(*lane);
+        });
+    }
+    return true;
+}
+
+void RedisNoReply::Stop() {
+    if(!running_){
+        return;
+    }
+    Flush(timeout_);
+    running_ = false;
+    for(const auto& item : lanes_){
+        {
+            lock_guard<mutex> locker(item->mtx);
+        }
+        item->cv.notify_all();
+        item->worker.join();
+        // 没有发送出去的命令计入丢失
+        stat_.lostCount += item->count + item->unacked;
+        stat_.bufferSize -= item->buffer.size();
+        item->buffer.clear();
+        item->count = 0;
+        item->unacked = 0;
+        item->conn.closeConnect();
+    }
+}
+
+bool RedisNoReply::Connect(Lane& lane) {
+    // 回复很小,只需要很小的接收缓冲区
+    if(lane.conn.connectRedis(host_, port_, timeout_, 64 * 1024) && lane.conn.auth(passwd_) > 0 &&
+       lane.conn.write(REPLY_OFF.c_str(), REPLY_OFF.size()) >= 0){
+        return true;
+    }
+    lane.conn.closeConnect();
+    return false;
+}
+
+void RedisNoReply::Lost(Lane& lane) {
+    stat_.lostCount += lane.unacked;
+    lane.unacked = 0;
+    lane.conn.closeConnect();
+}
+
+int RedisNoReply::Ack(Lane& lane) {
+    bool ok = false;
+    if(lane.conn.write(REPLY_ON.c_str(), REPLY_ON.size()) < 0 ||
+       lane.conn.recvReply(1, [&](const char* msg, const char* end){
+           ok = end - msg >= 3 && memcmp(msg, "+OK", 3) == 0;
+       }, timeout_) < 0 || !ok || lane.conn.write(REPLY_OFF.c_str(), REPLY_OFF.size()) < 0){
+        Lost(lane);
+        return RedisConnect::NETERR;
+    }
+    stat_.ackCount += lane.unacked;
+    lane.unacked = 0;
+    return RedisConnect::OK;
+}
+
+void RedisNoReply::Run(Lane& lane) {
+    string data;
+    int64 lastAck = RedisConnect::GetMillisecond();
+    unique_lock<mutex> locker(lane.mtx);
+    while(running_){
+        lane.cv.wait_for(locker, chrono::milliseconds(interval_), [&](){
+            return !lane.buffer.empty() || lane.flushSeq > lane.ackSeq || !running_;
+        });
+        if(!running_){
+            break;
+        }
+        int64 seq = lane.flushSeq;
+        int res = RedisConnect::OK;
+        locker.unlock();
+        // 连接切换为CLIENT REPLY OFF后不会收到数据,可读说明对端已经关闭,在发送之前重连
+        if(!lane.conn.isClosed() && RedisConnect::WaitReadable(lane.conn.getSocket(), INVALID_SOCKET, 0) == 1){
+            Lost(lane);
+        }
+        if(lane.conn.isClosed()){
+            ++stat_.reconnectCount;
+            if(!Connect(lane)){
+                res = RedisConnect::NETERR;
+            }
+        }
+        if(res == RedisConnect::OK){
+            int count = 0;
+            locker.lock();
+            data.swap(lane.buffer);
+            count = lane.count;
+            lane.count = 0;
+            locker.unlock();
+            // 缓冲区有了空间,唤醒等待的Post
+            lane.cv.notify_all();
+            if(!data.empty()){
+                stat_.bufferSize -= data.size();
+                // 部分写入时无法知道哪些命令已经到达服务端,整批计入丢失
+                if(lane.conn.write(data.c_str(), data.size()) < 0){
+                    lane.unacked += count;
+                    Lost(lane);
+                    res = RedisConnect::NETERR;
+                }else{
+                    stat_.sendCount += count;
+                    lane.unacked += count;
+                }
+                data.clear();
+            }
+            int64 now = RedisConnect::GetMillisecond();
+            if(res == RedisConnect::OK && (seq > lane.ackSeq || (lane.unacked > 0 && now - lastAck >= interval_))){
+                res = Ack(lane);
+                lastAck = now;
+            }
+        }
+        locker.lock();
+        if(seq > lane.ackSeq){
+            lane.ackSeq = seq;
+            lane.ackRes = res;
+            lane.cv.notify_all();
+        }
+        // 连接断开后每秒重连一次,期间有Flush请求时立即重试
+        if(res < 0){
+            lane.cv.wait_for(locker, chrono::milliseconds(1000), [&](){
+                return lane.flushSeq > lane.ackSeq || !running_;
+            });
+        }
+    }
+}
+
+int RedisNoReply::Post(const RedisConnect::Command& cmd) {
+    const vector<string>& args = cmd.getCommand();
+    if(!running_){
+        return RedisConnect::NETCLOSE;
+    }
+    if(args.empty()){
+        return RedisConnect::PARAMERR;
+    }
+    string data = cmd.toString();
+    Lane& lane = *lanes_[args.size() > 1 ? std::hash<string>()(args[1]) % lanes_.size() : 0];
+    ++stat_.postCount;
+    unique_lock<mutex> locker(lane.mtx);
+    auto full = [&](){
+        return !lane.buffer.empty() && lane.buffer.size() + data.size() > (size_t)maxBuffer_;
+    };
+    if(full()){
+        ++stat_.blockedCount;
+        if(wait_ <= 0 || !lane.cv.wait_for(locker, chrono::milliseconds(wait_), [&](){
+            return !full() || !running_;
+        }) || !running_){
+            ++stat_.dropCount;
+            return RedisConnect::SYSBUSY;
+        }
+    }
+    bool empty = lane.buffer.empty();
+    lane.buffer += data;
+    ++lane.count;
+    stat_.bufferSize += data.size();
+    // 后台线程只在缓冲区为空时等待
+    if(empty){
+        lane.cv.notify_all();
+    }
+    return RedisConnect::OK;
+}
+
+int RedisNoReply::Flush(int timeout) {
+    int res = RedisConnect::OK;
+    vector<int64> seqs;
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout);
+    for(const auto& item : lanes_){
+        {
+            lock_guard<mutex> locker(item->mtx);
+            seqs.push_back(++item->flushSeq);
+        }
+        item->cv.notify_all();
+    }
+    for(size_t i = 0; i < lanes_.size(); ++i){
+        Lane& lane = *lanes_[i];
+        unique_lock<mutex> locker(lane.mtx);
+        if(!lane.cv.wait_until(locker, deadline, [&](){
+            return lane.ackSeq >= seqs[i] || !running_;
+        }) || lane.ackSeq < seqs[i]){
+            res = RedisConnect::TIMEOUT;
+        }else if(lane.ackRes < 0 && res == RedisConnect::OK){
+            res = lane.ackRes;
+        }
+    }
+    return res;
+}
+
+const RedisNoReply::Stat& RedisNoReply::GetStat() const {
+    return stat_;
+}
@@ -0,0 +1,101 @@
+#ifndef REDISNOREPLY
+#define REDISNOREPLY
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <condition_variable>
+
+#include "typedef.h"
+#include "RedisConn.h"
+
+using namespace std;
+
+// 单向写入:用于不关心回复的写命令(指标、日志类的set/expire/lpush/incr等).Post把命令编码后追加到
+// 有上限的发送缓冲区就返回,后台线程把积累的命令一次交给内核.连接事先切换为CLIENT REPLY OFF,
+// 服务端不再回复,不占用连接池中的连接,也不需要等待往返.同一个键的命令总是经过同一条连接,保持顺序.
+// 缓冲区满时Post最多等待wait毫秒,仍然没有空间就丢弃命令并返回SYSBUSY.
+// 服务端不回复时无法知道单个命令是否执行成功(WRONGTYPE等错误同样被丢弃),后台线程每隔interval毫秒
+// 用CLIENT REPLY ON确认一次之前发送的命令都已被服务端处理;连接断开时已发送但未确认的命令计入lostCount,
+// 不会重发(incr、lpush等命令重发可能重复执行),缓冲区中还没有发送的命令在重连后继续发送
+class RedisNoReply {
+public:
+    // 统计信息
+    struct Stat {
+        atomic<int64> postCount;       // Post接受的命令数
+        atomic<int64> sendCount;       // 已交给内核的命令数
+        atomic<int64> ackCount;        // 确认已被服务端处理的命令数
+        atomic<int64> blockedCount;    // 缓冲区满需要等待的次数
+        atomic<int64> dropCount;       // 缓冲区满被丢弃的命令数
+        atomic<int64> lostCount;       // 连接断开时不确定是否执行的命令数(包括Stop时没有发送出去的命令)
+        atomic<int64> reconnectCount;  // 重连次数
+        atomic<int64> bufferSize;      // 所有缓冲区中等待发送的字节数
+
+        Stat() : postCount(0), sendCount(0), ackCount(0), blockedCount(0), dropCount(0),
+                 lostCount(0), reconnectCount(0), bufferSize(0) {}
+    };
+
+public:
+    RedisNoReply();
+    // 析构时发送剩余的命令并停止后台线程
+    ~RedisNoReply();
+
+    // 为conns条连接各启动一个后台发送线程,maxBuffer为每条连接的缓冲区上限(字节),interval为确认间隔(毫秒).
+    // 连接失败时后台线程每秒重连一次,期间命令保留在缓冲区中
+    bool Start(const string& host, int port, const string& pwd = "", int conns = 1,
+               int maxBuffer = 4 * 1024 * 1024, int wait = 100, int interval = 1000, int timeout = 3000);
+    // 等待剩余的命令发送并确认(最多timeout毫秒)后关闭连接
+    void Stop();
+
+    // 成功放入缓冲区返回OK,缓冲区满返回SYSBUSY,没有启动返回NETCLOSE
+    int Post(const RedisConnect::Command& cmd);
+
+    template<typename T, typename ...ARGS>
+    int Post(T val, ARGS ...args) {
+        RedisConnect::Command cmd;
+        cmd.add(val, args...);
+        return Post(cmd);
+    }
+
+    // 等待已Post的命令全部发送并得到服务端确认,超时返回TIMEOUT,连接断开返回NETERR
+    int Flush(int timeout = 3000);
+    const Stat& GetStat() const;
+
+private:
+    struct Lane {
+        mutex mtx;
+        condition_variable cv;
+        string buffer;     // 等待发送的命令
+        int count;         // buffer中的命令数
+        int64 unacked;     // 已发送但还没有确认的命令数(只由后台线程访问)
+        int64 flushSeq;    // Flush请求的序号
+        int64 ackSeq;      // 已完成确认的Flush序号
+        int ackRes;        // 最近一次确认的结果
+        RedisConnect conn;
+        std::thread worker;
+
+        Lane() : count(0), unacked(0), flushSeq(0), ackSeq(0), ackRes(RedisConnect::OK) {}
+    };
+
+    bool Connect(Lane& lane);
+    int Ack(Lane& lane);
+    void Lost(Lane& lane);
+    void Run(Lane& lane);
+
+    string host_;
+    int port_;
+    string passwd_;
+    int maxBuffer_;
+    int wait_;
+    int interval_;
+    int timeout_;
+
+    vector<shared_ptr<Lane>> lanes_;
+    atomic<bool> running_;
+
+    Stat stat_;
+};
+
+#endif
@@ -0,0 +1,277 @@
+#include "RedisShard.h"
+
+RedisShardPool::RedisShardPool() : connSize_(8), timeout_(3000),
+    memsz_(2 * 1024 * 1024), vnodes_(VIRTUAL_NODES), ring_(make_shared<Ring>()) {
+
+}
+
+RedisShardPool::~RedisShardPool() {
+    for(const auto& pool : GetRing()->pools){
+        pool->ClosePool();
+    }
+}
+
+void RedisShardPool::Init(const vector<pair<string, int>>& shards, const string& pwd,
+                          int connSize, int timeout, int memsz, int vnodes) {
+    passwd_ = pwd;
+    connSize_ = connSize;
+    timeout_ = timeout;
+    memsz_ = memsz;
+    vnodes_ = vnodes;
+    for(const auto& item : shards){
+        AddShard(item.first, item.second);
+    }
+}
+
+int RedisShardPool::AddShard(const string& host, int port) {
+    shared_ptr<RedisConnPool> pool = make_shared<RedisConnPool>();
+    pool->Init(host, port, passwd_, connSize_, timeout_, memsz_);
+
+    lock_guard<mutex> locker(mtx_);
+    // 复制当前的分片列表,重建哈希环后整体替换,正在读取旧环的调用不受影响
+    shared_ptr<Ring> ring = make_shared<Ring>(*GetRing());
+    ring->pools.push_back(pool);
+    ring->names.push_back(host + ":" + to_string(port));
+    ring->nodes.clear();
+    for(size_t i = 0; i < ring->names.size(); ++i){
+        for(int j = 0; j < vnodes_; ++j){
+            string name = ring->names[i] + "#" + to_string(j);
+            ring->nodes.push_back(make_pair(Hash(name.c_str(), name.size()), (int)i));
+        }
+    }
+    sort(ring->nodes.begin(), ring->nodes.end());
+    atomic_store(&ring_, shared_ptr<const Ring>(ring));
+    return ring->pools.size() - 1;
+}
+
+int RedisShardPool::GetShardCount() const {
+    return GetRing()->pools.size();
+}
+
+shared_ptr<const RedisShardPool::Ring> RedisShardPool::GetRing() const {
+    return atomic_load(&ring_);
+}
+
+string RedisShardPool::HashTag(const string& key) {
+    size_t pos = key.find('{');
+    if(pos == string::npos){
+        return key;
+    }
+    size_t end = key.find('}', pos + 1);
+    // 与Redis Cluster一致,{}为空时对整个键计算哈希
+    if(end == string::npos || end == pos + 1){
+        return key;
+    }
+    return key.substr(pos + 1, end - pos - 1);
+}
+
+u_int64 RedisShardPool::Hash(const char* data, int len) {
+    // FNV-1a,再用MurmurHash3的fmix64打散,保证虚拟节点在环上分布均匀
+    u_int64 h = 14695981039346656037ULL;
+    for(int i = 0; i < len; ++i){
+        h ^= (u_char)(data[i]);
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+int RedisShardPool::GetShardIndex(const string& key) const {
+    return GetShardIndex(*GetRing(), key);
+}
+
+int RedisShardPool::GetShardIndex(const Ring& ring, const string& key) {
+    if(ring.nodes.empty()){
+        return -1;
+    }
+    string tag = HashTag(key);
+    u_int64 h = Hash(tag.c_str(), tag.size());
+    auto it = lower_bound(ring.nodes.begin(), ring.nodes.end(), make_pair(h, 0));
+    if(it == ring.nodes.end()){
+        it = ring.nodes.begin();
+    }
+    return it->second;
+}
+
+RedisConnPool* RedisShardPool::GetPool(const string& key) const {
+    shared_ptr<const Ring> ring = GetRing();
+    int idx = GetShardIndex(*ring, key);
+    // 连接池只增加不删除,返回后仍然有效
+    return idx < 0 ? NULL : ring->pools[idx].get();
+}
+
+RedisConnPool* RedisShardPool::GetPoolByIndex(int idx) const {
+    return GetRing()->pools.at(idx).get();
+}
+
+int RedisShardPool::Execute(RedisConnect::Command& cmd) {
+    const vector<string>& args = cmd.getCommand();
+    RedisConnPool* pool = args.size() > 1 ? GetPool(args[1]) : GetPoolByIndex(0);
+    if(pool == NULL){
+        return RedisConnect::PARAMERR;
+    }
+    return pool->Execute(cmd);
+}
+
+template<typename KEY>
+bool RedisShardPool::Group(const Ring& ring, int count, KEY key, vector<vector<int>>& groups) {
+    groups.assign(ring.pools.size(), vector<int>());
+    for(int i = 0; i < count; ++i){
+        int idx = GetShardIndex(ring, key(i));
+        if(idx < 0){
+            return false;
+        }
+        groups[idx].push_back(i);
+    }
+    return true;
+}
+
+int RedisShardPool::FanOut(const Ring& ring, const vector<vector<int>>& groups, bool read,
+                           const function<void(int, const vector<int>&, Batch&)>& build,
+                           const function<int(int, const vector<int>&, Batch&, int)>& collect) {
+    int res = RedisConnect::OK;
+    vector<shared_ptr<RedisConnect>> conns(groups.size());
+    vector<Batch> batches(groups.size());
+    vector<int> codes(groups.size(), (int)(RedisConnect::OK));
+
+    // 先在所有分片上发送,各分片的往返时间重叠
+    for(size_t i = 0; i < groups.size(); ++i){
+        if(groups[i].empty()){
+            continue;
+        }
+        RedisConnPool* pool = ring.pools[i].get();
+        build(i, groups[i], batches[i]);
+        conns[i] = read ? pool->GetReadConn() : pool->GetConn();
+        if(!conns[i]){
+            codes[i] = RedisConnect::NETERR;
+            continue;
+        }
+        codes[i] = conns[i]->sendPipeline(batches[i].data(), batches[i].size());
+    }
+    // 再依次接收各分片的回复
+    for(size_t i = 0; i < groups.size(); ++i){
+        if(groups[i].empty()){
+            continue;
+        }
+        if(conns[i]){
+            if(codes[i] >= 0){
+                codes[i] = conns[i]->recvPipeline(batches[i].data(), batches[i].size());
+            }
+            ring.pools[i]->FreeConn(conns[i]);
+        }
+        int code = collect(i, groups[i], batches[i], codes[i]);
+        if(code < 0 && res >= 0){
+            res = code;
+        }
+    }
+    return res;
+}
+
+int RedisShardPool::Pipeline(vector<RedisConnect::Command>& cmds) {
+    shared_ptr<const Ring> ring = GetRing();
+    vector<vector<int>> groups;
+
+    if(!Group(*ring, cmds.size(), [&](int i){
+        const vector<string>& args = cmds[i].getCommand();
+        return args.size() > 1 ? args[1] : string();
+    }, groups)){
+        return RedisConnect::PARAMERR;
+    }
+
+    return FanOut(*ring, groups, false, [&](int, const vector<int>& idxs, Batch& batch){
+        for(int i : idxs){
+            batch.push_back(std::move(cmds[i]));
+        }
+    }, [&](int, const vector<int>& idxs, Batch& batch, int res){
+        for(size_t i = 0; i < idxs.size(); ++i){
+            cmds[idxs[i]] = std::move(batch[i]);
+        }
+        return res;
+    });
+}
+
+int RedisShardPool::MGet(const vector<string>& keys, vector<string>& vals) {
+    shared_ptr<const Ring> ring = GetRing();
+    vector<vector<int>> groups;
+
+    vals.assign(keys.size(), string());
+    if(!Group(*ring, keys.size(), [&](int i){
+        return keys[i];
+    }, groups)){
+        return RedisConnect::PARAMERR;
+    }
+
+    return FanOut(*ring, groups, true, [&](int, const vector<int>& idxs, Batch& batch){
+        batch.push_back(RedisConnect::Command("mget"));
+        for(int i : idxs){
+            batch[0].add(keys[i]);
+        }
+    }, [&](int, const vector<int>& idxs, Batch& batch, int res){
+        if(res < 0 || (res = batch[0].getCode()) < 0){
+            return res;
+        }
+        const vector<string>& data = batch[0].getDataList();
+        for(size_t i = 0; i < idxs.size() && i < data.size(); ++i){
+            vals[idxs[i]] = data[i];
+        }
+        return res;
+    });
+}
+
+int RedisShardPool::MSet(const vector<pair<string, string>>& kvs) {
+    shared_ptr<const Ring> ring = GetRing();
+    vector<vector<int>> groups;
+
+    if(!Group(*ring, kvs.size(), [&](int i){
+        return kvs[i].first;
+    }, groups)){
+        return RedisConnect::PARAMERR;
+    }
+
+    return FanOut(*ring, groups, false, [&](int, const vector<int>& idxs, Batch& batch){
+        batch.push_back(RedisConnect::Command("mset"));
+        for(int i : idxs){
+            batch[0].add(kvs[i].first, kvs[i].second);
+        }
+    }, [&](int, const vector<int>&, Batch& batch, int res){
+        return res < 0 ? res : batch[0].getCode();
+    });
+}
+
+int RedisShardPool::Del(const vector<string>& keys, int64* deleted) {
+    shared_ptr<const Ring> ring = GetRing();
+    vector<vector<int>> groups;
+    int64 total = 0;
+
+    if(deleted){
+        *deleted = 0;
+    }
+    if(!Group(*ring, keys.size(), [&](int i){
+        return keys[i];
+    }, groups)){
+        return RedisConnect::PARAMERR;
+    }
+
+    int res = FanOut(*ring, groups, false, [&](int, const vector<int>& idxs, Batch& batch){
+        batch.push_back(RedisConnect::Command("del"));
+        for(int i : idxs){
+            batch[0].add(keys[i]);
+        }
+    }, [&](int, const vector<int>&, Batch& batch, int res){
+        if(res < 0 || (res = batch[0].getCode()) < 0){
+            return res;
+        }
+        // 与单节点的del一样,删除的键数在整型回复中
+        total += batch[0].getInteger();
+        return res;
+    });
+
+    if(deleted){
+        *deleted = total;
+    }
+    return res;
+}
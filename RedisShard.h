@@ -0,0 +1,85 @@
+#ifndef REDISSHARD
+#define REDISSHARD
+#include <map>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <memory>
+#include <iostream>
+#include <algorithm>
+
+#include "typedef.h"
+#include "RedisConnPool.h"
+
+using namespace std;
+
+// 客户端分片:每个分片(独立的redis-server)对应一个RedisConnPool,
+// 键通过一致性哈希环映射到分片,增加分片时只有少量键需要迁移.
+// 哈希环与连接池列表整体替换(写时复制),AddShard可以与读取并发执行
+class RedisShardPool {
+public:
+    static const int VIRTUAL_NODES = 160;  // 每个分片默认的虚拟节点数
+
+public:
+    RedisShardPool();
+    ~RedisShardPool();
+
+    void Init(const vector<pair<string, int>>& shards, const string& pwd = "",
+              int connSize = 8, int timeout = 3000, int memsz = 2 * 1024 * 1024,
+              int vnodes = VIRTUAL_NODES);
+    // 增加一个分片(密码、连接数等参数同Init),返回分片序号.正在执行的调用继续使用增加之前的分片
+    int AddShard(const string& host, int port);
+    int GetShardCount() const;
+
+    // 获取键所在的分片
+    int GetShardIndex(const string& key) const;
+    RedisConnPool* GetPool(const string& key) const;
+    RedisConnPool* GetPoolByIndex(int idx) const;
+
+    // 单键命令,按第一个参数(键)路由
+    int Execute(RedisConnect::Command& cmd);
+    // 批量执行单键命令:按分片拆分,每个分片一次pipeline,先向所有分片发送再依次接收
+    int Pipeline(vector<RedisConnect::Command>& cmds);
+    // 跨分片的MGET/MSET/DEL,按分片拆分后同时发送,vals与keys一一对应(不存在的键为空字符串),
+    // deleted返回各分片删除的键数之和
+    int MGet(const vector<string>& keys, vector<string>& vals);
+    int MSet(const vector<pair<string, string>>& kvs);
+    int Del(const vector<string>& keys, int64* deleted = NULL);
+
+    // 键的哈希标签:包含{tag}时只对tag计算哈希,使相关的键落在同一个分片
+    static string HashTag(const string& key);
+    static u_int64 Hash(const char* data, int len);
+
+private:
+    typedef vector<RedisConnect::Command> Batch;
+
+    // 分片列表与哈希环,创建后不再修改
+    struct Ring {
+        vector<string> names;  // 分片名称host:port,用于计算虚拟节点
+        vector<shared_ptr<RedisConnPool>> pools;
+        vector<pair<u_int64, int>> nodes;  // 虚拟节点哈希值 -> 分片序号
+    };
+
+    shared_ptr<const Ring> GetRing() const;
+    static int GetShardIndex(const Ring& ring, const string& key);
+    // 按键把下标分组到各分片,有无法路由的键时返回false
+    template<typename KEY>
+    static bool Group(const Ring& ring, int count, KEY key, vector<vector<int>>& groups);
+    // 在各分片上执行命令:build(分片序号, 下标列表, 命令)生成命令,先在每个分片的连接上发送,
+    // 再依次接收回复并调用collect(分片序号, 下标列表, 命令, 执行结果)(发送失败时也会调用),
+    // 返回第一个小于0的collect结果.按分片序号依次获取连接,不会与其它调用相互等待死锁
+    int FanOut(const Ring& ring, const vector<vector<int>>& groups, bool read,
+               const function<void(int, const vector<int>&, Batch&)>& build,
+               const function<int(int, const vector<int>&, Batch&, int)>& collect);
+
+    string passwd_;
+    int connSize_;
+    int timeout_;
+    int memsz_;
+    int vnodes_;
+
+    std::mutex mtx_;  // 保证同一时间只有一个AddShard替换ring_
+    shared_ptr<const Ring> ring_;  // 通过atomic_load/atomic_store读写
+};
+
+#endif
@@ -0,0 +1,474 @@
+#include "RedisSpool.h"
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static const char SPOOL_MAGIC[] = "RSPOOL01";
+static const int64 SPOOL_HEAD_SIZE = 16;   // magic(8字节)与已回放的位置(8字节)
+static const int64 SPOOL_BATCH_BYTES = 4 * 1024 * 1024;  // 每批回放的数据上限
+
+RedisSpool::RedisSpool() : segmentSize_(0), maxSize_(0), pool_(NULL), batch_(1000), interval_(1000),
+    timeout_(3000), down_(false), running_(false), signaled_(false) {
+}
+
+RedisSpool::~RedisSpool() {
+    Stop();
+    lock_guard<mutex> locker(mtx_);
+    for(const auto& seg : segments_){
+        CloseSegment(*seg, false);
+    }
+    segments_.clear();
+}
+
+bool RedisSpool::Open(const string& dir, int64 segmentSize, int64 maxSize) {
+    vector<int64> seqs;
+    lock_guard<mutex> locker(mtx_);
+    if(!dir_.empty() || segmentSize <= SPOOL_HEAD_SIZE * 2 || maxSize < segmentSize){
+        return false;
+    }
+    if(mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST){
+        return false;
+    }
+    DIR* handle = opendir(dir.c_str());
+    if(handle == NULL){
+        return false;
+    }
+    while(struct dirent* item = readdir(handle)){
+        long long seq = 0;
+        char tail[8] = {0};
+        if(sscanf(item->d_name, "spool.%lld.%4s", &seq, tail) == 2 && strcmp(tail, "log") == 0){
+            seqs.push_back(seq);
+        }
+    }
+    closedir(handle);
+    sort(seqs.begin(), seqs.end());
+
+    dir_ = dir;
+    segmentSize_ = segmentSize;
+    maxSize_ = maxSize;
+    for(int64 seq : seqs){
+        shared_ptr<Segment> seg = OpenSegment(seq, false);
+        if(!seg){
+            cout << "RedisSpool skip invalid segment " << dir_ << "/spool." << seq << ".log" << endl;
+            continue;
+        }
+        // 恢复等待回放的命令
+        for(int64 pos = seg->readPos; pos < seg->writePos; ){
+            u_int32 len = 0;
+            memcpy(&len, seg->data + pos, 4);
+            AddKey(seg->data + pos + 8, len);
+            ++stat_.depth;
+            stat_.depthBytes += len;
+            pos += 8 + len;
+        }
+        // 已经回放完的段文件不再需要(最后一个段继续写入)
+        if(seg->readPos >= seg->writePos && seq != seqs.back()){
+            CloseSegment(*seg, true);
+            continue;
+        }
+        segments_.push_back(seg);
+    }
+    stat_.segmentCount = segments_.size();
+    return true;
+}
+
+shared_ptr<RedisSpool::Segment> RedisSpool::OpenSegment(int64 seq, bool create) {
+    shared_ptr<Segment> seg = make_shared<Segment>();
+    struct stat st;
+    seg->seq = seq;
+    seg->path = dir_ + "/spool." + to_string(seq) + ".log";
+    seg->fd = open(seg->path.c_str(), create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR, 0644);
+    seg->data = NULL;
+    if(seg->fd < 0){
+        return nullptr;
+    }
+    if(create && ftruncate(seg->fd, segmentSize_) < 0){
+        CloseSegment(*seg, true);
+        return nullptr;
+    }
+    if(fstat(seg->fd, &st) < 0 || st.st_size < SPOOL_HEAD_SIZE * 2){
+        CloseSegment(*seg, create);
+        return nullptr;
+    }
+    seg->size = st.st_size;
+    void* data = mmap(NULL, seg->size, PROT_READ | PROT_WRITE, MAP_SHARED, seg->fd, 0);
+    if(data == MAP_FAILED){
+        CloseSegment(*seg, create);
+        return nullptr;
+    }
+    seg->data = (char*)data;
+    if(create){
+        memcpy(seg->data, SPOOL_MAGIC, 8);
+        seg->writePos = SPOOL_HEAD_SIZE;
+        SetReadPos(*seg, SPOOL_HEAD_SIZE);
+        return seg;
+    }
+    if(memcmp(seg->data, SPOOL_MAGIC, 8) != 0){
+        CloseSegment(*seg, false);
+        return nullptr;
+    }
+    // 从头扫描到第一个不完整或校验失败的记录(写到一半时进程退出)为止
+    int64 pos = SPOOL_HEAD_SIZE;
+    while(pos + 8 <= seg->size){
+        u_int32 len = 0;
+        u_int32 sum = 0;
+        memcpy(&len, seg->data + pos, 4);
+        memcpy(&sum, seg->data + pos + 4, 4);
+        if(len == 0 || pos + 8 + len > seg->size || Checksum(seg->data + pos + 8, len) != sum){
+            break;
+        }
+        pos += 8 + len;
+    }
+    seg->writePos = pos;
+    if(pos + 8 <= seg->size){
+        memset(seg->data + pos, 0, 8);
+    }
+    memcpy(&seg->readPos, seg->data + 8, 8);
+    if(seg->readPos < SPOOL_HEAD_SIZE || seg->readPos > seg->writePos){
+        SetReadPos(*seg, seg->writePos);
+    }
+    return seg;
+}
+
+void RedisSpool::CloseSegment(Segment& seg, bool remove) {
+    if(seg.data){
+        msync(seg.data, seg.size, MS_SYNC);
+        munmap(seg.data, seg.size);
+        seg.data = NULL;
+    }
+    if(seg.fd >= 0){
+        close(seg.fd);
+        seg.fd = -1;
+    }
+    if(remove){
+        unlink(seg.path.c_str());
+    }
+}
+
+void RedisSpool::SetReadPos(Segment& seg, int64 pos) {
+    seg.readPos = pos;
+    memcpy(seg.data + 8, &pos, 8);
+}
+
+bool RedisSpool::Start(RedisConnPool* pool, int batch, int interval, int timeout) {
+    if(running_ || pool == NULL || batch <= 0 || interval <= 0 || dir_.empty()){
+        return false;
+    }
+    pool_ = pool;
+    batch_ = batch;
+    interval_ = interval;
+    timeout_ = timeout;
+    // 有上次没有回放完的命令时立即开始回放
+    signaled_ = stat_.depth > 0;
+    running_ = true;
+    worker_ = std::thread([this](){
+        Run();
+    });
+    return true;
+}
+
+void RedisSpool::Stop() {
+    if(running_){
+        {
+            lock_guard<mutex> locker(runMtx_);
+            running_ = false;
+        }
+        cv_.notify_all();
+        worker_.join();
+    }
+}
+
+void RedisSpool::Run() {
+    unique_lock<mutex> locker(runMtx_);
+    while(running_){
+        cv_.wait_for(locker, chrono::milliseconds(interval_), [this](){
+            return signaled_ || !running_;
+        });
+        signaled_ = false;
+        if(!running_){
+            break;
+        }
+        locker.unlock();
+        // 不可用时先探测,恢复后一直回放到暂存为空或再次出错
+        if(stat_.depth > 0 && (!down_ || Probe())){
+            while(running_ && stat_.depth > 0 && Drain() > 0){
+            }
+        }else if(down_){
+            Probe();
+        }
+        {
+            lock_guard<mutex> segLocker(mtx_);
+            for(const auto& seg : segments_){
+                msync(seg->data, seg->size, MS_ASYNC);
+            }
+        }
+        locker.lock();
+    }
+}
+
+int RedisSpool::Request(const function<int(RedisConnect*)>& func) {
+    return pool_->Write([&](RedisConnect* redis){
+        bool direct = !redis->getExecutor();
+        // 之前出错的连接先重连
+        if(direct && redis->isClosed() && !redis->reconnect()){
+            return (int)(RedisConnect::NETERR);
+        }
+        int res = func(redis);
+        // 出错的连接上可能还有没有读完的回复,关闭后下次使用前重连
+        if(direct && IsNetError(res)){
+            redis->closeConnect();
+        }
+        return res;
+    });
+}
+
+bool RedisSpool::Probe() {
+    if(Request([](RedisConnect* redis){
+        return redis->ping();
+    }) < 0){
+        return false;
+    }
+    down_ = false;
+    return true;
+}
+
+int RedisSpool::Write(RedisConnect::Command& cmd) {
+    const vector<string>& args = cmd.getCommand();
+    bool pending = false;
+    int res = RedisConnect::OK;
+    if(args.empty()){
+        return RedisConnect::PARAMERR;
+    }
+    // 没有启动时只能写入暂存,没有打开时Append返回SYSERR
+    if(pool_ == NULL){
+        return Append(cmd);
+    }
+    // 检查暂存、直接执行与转入暂存都在键的写入权内完成,同一个键后面的写入不会越过失败的写入
+    string key = args.size() > 1 ? args[1] : string();
+    LockKey(key);
+    {
+        lock_guard<mutex> locker(mtx_);
+        pending = keys_.count(key) > 0;
+    }
+    if(!pending && !down_){
+        res = Request([&](RedisConnect* redis){
+            return redis->execute(cmd);
+        });
+        if(IsNetError(res)){
+            down_ = true;
+            res = Append(cmd);
+        }
+    }else{
+        res = Append(cmd);
+    }
+    UnlockKey(key);
+    return res;
+}
+
+void RedisSpool::LockKey(const string& key) {
+    unique_lock<mutex> locker(mtx_);
+    KeyLock& item = writing_[key];
+    if(item.count++ > 0){
+        keyCv_.wait(locker, [&](){
+            return !item.busy;
+        });
+    }
+    item.busy = true;
+}
+
+void RedisSpool::UnlockKey(const string& key) {
+    lock_guard<mutex> locker(mtx_);
+    auto it = writing_.find(key);
+    it->second.busy = false;
+    if(--it->second.count <= 0){
+        writing_.erase(it);
+        return;
+    }
+    keyCv_.notify_all();
+}
+
+int RedisSpool::Append(const RedisConnect::Command& cmd) {
+    string data = cmd.toString();
+    int64 need = 8 + data.size();
+    bool empty = false;
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(dir_.empty()){
+            return RedisConnect::SYSERR;
+        }
+        if(need > segmentSize_ - SPOOL_HEAD_SIZE){
+            ++stat_.rejectCount;
+            return RedisConnect::PARAMERR;
+        }
+        Segment* seg = segments_.empty() ? NULL : segments_.back().get();
+        if(seg == NULL || seg->writePos + need > seg->size){
+            if((int64)(segments_.size() + 1) * segmentSize_ > maxSize_){
+                ++stat_.rejectCount;
+                return RedisConnect::SYSBUSY;
+            }
+            shared_ptr<Segment> next = OpenSegment(seg ? seg->seq + 1 : 1, true);
+            if(!next){
+                ++stat_.rejectCount;
+                return RedisConnect::SYSERR;
+            }
+            segments_.push_back(next);
+            ++stat_.segmentCount;
+            seg = next.get();
+        }
+        char* pos = seg->data + seg->writePos;
+        u_int32 len = data.size();
+        u_int32 sum = Checksum(data.c_str(), len);
+        // 先写数据与结束标记,最后写长度,记录写到一半时恢复会在这里停止
+        memcpy(pos + 8, data.c_str(), len);
+        if(seg->writePos + need + 8 <= seg->size){
+            memset(pos + need, 0, 8);
+        }
+        memcpy(pos + 4, &sum, 4);
+        memcpy(pos, &len, 4);
+        seg->writePos += need;
+        AddKey(data.c_str(), len);
+        empty = stat_.depth++ == 0;
+        stat_.depthBytes += len;
+        ++stat_.appendCount;
+    }
+    if(empty && running_){
+        {
+            lock_guard<mutex> locker(runMtx_);
+            signaled_ = true;
+        }
+        cv_.notify_one();
+    }
+    return RedisConnect::OK;
+}
+
+int RedisSpool::Drain() {
+    lock_guard<mutex> drainLocker(drainMtx_);
+    string data;
+    vector<pair<Segment*, int64>> recs;  // 本批记录所在的段与位置
+    {
+        lock_guard<mutex> locker(mtx_);
+        for(const auto& seg : segments_){
+            int64 pos = seg->readPos;
+            while(pos < seg->writePos && (int)recs.size() < batch_ && (int64)data.size() < SPOOL_BATCH_BYTES){
+                u_int32 len = 0;
+                memcpy(&len, seg->data + pos, 4);
+                data.append(seg->data + pos + 8, len);
+                recs.push_back(make_pair(seg.get(), pos));
+                pos += 8 + len;
+            }
+            if((int)recs.size() >= batch_ || (int64)data.size() >= SPOOL_BATCH_BYTES){
+                break;
+            }
+        }
+    }
+    if(recs.empty() || pool_ == NULL){
+        return 0;
+    }
+
+    int replied = 0;
+    int errors = 0;
+    int res = Request([&](RedisConnect* redis){
+        return redis->request(data, recs.size(), [&](const char* msg, const char*){
+            if(*msg == '-'){
+                ++errors;
+            }
+            ++replied;
+        }, timeout_);
+    });
+
+    // 收到回复的命令已经执行,从暂存中移除;其余的下次重新回放
+    lock_guard<mutex> locker(mtx_);
+    for(int i = 0; i < replied; ++i){
+        Segment& seg = *recs[i].first;
+        u_int32 len = 0;
+        memcpy(&len, seg.data + recs[i].second, 4);
+        RemoveKey(seg.data + recs[i].second + 8, len);
+        SetReadPos(seg, recs[i].second + 8 + len);
+        --stat_.depth;
+        stat_.depthBytes -= len;
+    }
+    stat_.replayCount += replied;
+    stat_.errorCount += errors;
+    // 删除回放完的段文件,最后一个段回放完时从头重新写入
+    while(segments_.size() > 1 && segments_.front()->readPos >= segments_.front()->writePos){
+        CloseSegment(*segments_.front(), true);
+        segments_.erase(segments_.begin());
+        --stat_.segmentCount;
+    }
+    if(segments_.size() == 1 && segments_.front()->readPos >= segments_.front()->writePos){
+        Segment& seg = *segments_.front();
+        memset(seg.data + SPOOL_HEAD_SIZE, 0, 8);
+        seg.writePos = SPOOL_HEAD_SIZE;
+        SetReadPos(seg, SPOOL_HEAD_SIZE);
+    }
+    if(res < 0){
+        down_ = true;
+        return res;
+    }
+    return replied;
+}
+
+void RedisSpool::AddKey(const char* data, int64 len) {
+    string key;
+    ParseKey(data, len, key);
+    ++keys_[key];
+}
+
+void RedisSpool::RemoveKey(const char* data, int64 len) {
+    string key;
+    ParseKey(data, len, key);
+    auto it = keys_.find(key);
+    if(it != keys_.end() && --it->second <= 0){
+        keys_.erase(it);
+    }
+}
+
+bool RedisSpool::IsDown() const {
+    return down_;
+}
+
+const RedisSpool::Stat& RedisSpool::GetStat() const {
+    return stat_;
+}
+
+bool RedisSpool::IsNetError(int code) {
+    return RedisConnect::IsNetError(code) || code == RedisConnect::CIRCUITOPEN;
+}
+
+u_int32 RedisSpool::Checksum(const char* data, int64 len) {
+    u_int32 h = 2166136261U;
+    for(int64 i = 0; i < len; ++i){
+        h ^= (u_char)data[i];
+        h *= 16777619U;
+    }
+    return h;
+}
+
+bool RedisSpool::ParseKey(const char* data, int64 len, string& key) {
+    const char* tail = data + len;
+    const char* str = data;
+    const char* end = NULL;
+    int64 num = 0;
+    key.clear();
+    if(len <= 0 || *str != '*' || (end = RedisConnect::FindLineEnd(str + 1, tail)) == NULL ||
+       !RedisConnect::ParseInteger(str + 1, end, num)){
+        return false;
+    }
+    // 第二个参数作为键,没有键的命令使用空字符串
+    if(num < 2){
+        return true;
+    }
+    str = end + 2;
+    for(int i = 0; i < 2; ++i){
+        if(str >= tail || *str != '$' || (end = RedisConnect::FindLineEnd(str + 1, tail)) == NULL ||
+           !RedisConnect::ParseInteger(str + 1, end, num) || num < 0 || tail - end - 2 < num){
+            return false;
+        }
+        str = end + 2;
+        if(i == 1){
+            key.assign(str, num);
+        }
+        str += num + 2;
+    }
+    return true;
+}
@@ -0,0 +1,126 @@
+#ifndef REDISSPOOL
+#define REDISSPOOL
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <condition_variable>
+
+#include "typedef.h"
+#include "RedisConnPool.h"
+
+using namespace std;
+
+// 写入暂存:redis不可用(重启、主从切换)时,写命令按RESP编码追加到本地的内存映射段文件中,
+// 后台线程重连成功后把暂存的命令按写入顺序用大批量pipeline回放.某个键在暂存中还有等待回放的命令时,
+// 该键新的写命令也追加到暂存,保证同一个键的命令按顺序执行;其它键的命令直接执行.
+// 同一个键的并发写入依次执行,前一个写入因网络错误转入暂存后,后面的写入能看到暂存中的命令.
+// 段文件在进程崩溃后重新Open时恢复(写到一半的记录被丢弃),总大小超过上限时拒绝写入.
+// 网络错误时命令可能已经执行,回放是至少一次语义,适合计数、队列推送等可以容忍重复的写入
+class RedisSpool {
+public:
+    // 统计信息
+    struct Stat {
+        atomic<int64> appendCount;   // 写入暂存的命令数
+        atomic<int64> replayCount;   // 回放的命令数
+        atomic<int64> errorCount;    // 回放时收到错误回复的命令数(不重试)
+        atomic<int64> rejectCount;   // 超过容量上限被拒绝的命令数
+        atomic<int64> depth;         // 等待回放的命令数
+        atomic<int64> depthBytes;    // 等待回放的字节数
+        atomic<int64> segmentCount;  // 段文件数
+
+        Stat() : appendCount(0), replayCount(0), errorCount(0), rejectCount(0),
+                 depth(0), depthBytes(0), segmentCount(0) {}
+    };
+
+public:
+    RedisSpool();
+    // 析构时停止后台线程并关闭段文件(未回放的命令保留在文件中)
+    ~RedisSpool();
+
+    // 打开dir下的段文件(不存在时创建),恢复上次没有回放完的命令.
+    // segmentSize为每个段文件的大小,maxSize为所有段文件的总大小上限
+    bool Open(const string& dir, int64 segmentSize = 64 * 1024 * 1024, int64 maxSize = 1024 * 1024 * 1024);
+    // 启动后台回放线程,每隔interval毫秒检查一次连接,每批最多回放batch个命令
+    bool Start(RedisConnPool* pool, int batch = 1000, int interval = 1000, int timeout = 3000);
+    void Stop();
+
+    // 执行写命令:连接可用且该键没有等待回放的命令时直接执行,网络错误时写入暂存.
+    // 同一个键上一个写入还没有完成时等待它完成.
+    // 写入暂存时返回OK,暂存已满返回SYSBUSY,其它为执行结果.没有Start时(Start需要先Open)只写入暂存,
+    // 没有Open时返回SYSERR
+    int Write(RedisConnect::Command& cmd);
+    // 直接把命令写入暂存
+    int Append(const RedisConnect::Command& cmd);
+    // 回放一批命令,返回回放的命令数,网络错误返回NETERR
+    int Drain();
+    // redis是否不可用(由后台线程重连成功后恢复)
+    bool IsDown() const;
+    const Stat& GetStat() const;
+
+    static bool IsNetError(int code);
+
+private:
+    // 段文件:头部为magic与已回放的位置,之后是[长度(4字节)][校验(4字节)][RESP数据]组成的记录
+    struct Segment {
+        int64 seq;
+        string path;
+        int fd;
+        char* data;
+        int64 size;
+        int64 readPos;   // 下一个等待回放的记录
+        int64 writePos;  // 下一个记录写入的位置
+    };
+
+    shared_ptr<Segment> OpenSegment(int64 seq, bool create);
+    void CloseSegment(Segment& seg, bool remove);
+    void SetReadPos(Segment& seg, int64 pos);
+    void AddKey(const char* data, int64 len);
+    void RemoveKey(const char* data, int64 len);
+    // 获取、释放键的写入权,同一时间每个键只有一个Write在执行
+    void LockKey(const string& key);
+    void UnlockKey(const string& key);
+    // 在连接池的主节点连接上执行func,出错的连接关闭后在下次使用前重连
+    int Request(const function<int(RedisConnect*)>& func);
+    bool Probe();
+    void Run();
+
+    static u_int32 Checksum(const char* data, int64 len);
+    static bool ParseKey(const char* data, int64 len, string& key);
+
+    string dir_;
+    int64 segmentSize_;
+    int64 maxSize_;
+    RedisConnPool* pool_;
+    int batch_;
+    int interval_;
+    int timeout_;
+
+    vector<shared_ptr<Segment>> segments_;  // 按写入顺序排列,由mtx_保护
+    unordered_map<string, int> keys_;  // 有等待回放命令的键及命令数,由mtx_保护
+
+    // 键的写入权
+    struct KeyLock {
+        bool busy;  // 是否有Write正在执行
+        int count;  // 正在执行与等待的Write数
+    };
+
+    unordered_map<string, KeyLock> writing_;  // 正在写入的键,由mtx_保护
+    condition_variable keyCv_;
+    std::mutex mtx_;
+    std::mutex drainMtx_;  // 保证同一时间只有一个回放在执行
+    atomic<bool> down_;
+
+    atomic<bool> running_;
+    std::thread worker_;
+    std::mutex runMtx_;
+    condition_variable cv_;
+    bool signaled_;
+
+    Stat stat_;
+};
+
+#endif